@@ -0,0 +1,53 @@
+// Loops whose iteration cost is dominated by the loop control.
+// Run with the number of rounds; each round runs 300 iterations.
+
+#include <stdio.h>
+
+int sum_for(int *a, int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++)
+    s += a[i];
+  return s;
+}
+
+int sum_while(int *a, int n) {
+  int s = 0, i = 0;
+  while (i < n && a[i] != 100) {
+    if (a[i] < 0) {
+      i++;
+      continue;
+    }
+    s += a[i++];
+  }
+  return s;
+}
+
+int sum_do(int *a, int n) {
+  int s = 0, i = 0;
+  do {
+    if (a[i] == 0)
+      continue;
+    s += a[i];
+  } while (++i < n);
+  return s;
+}
+
+int main(int argc, char **argv) {
+  int rounds = 0;
+  for (char *p = argc > 1 ? argv[1] : ""; '0' <= *p && *p <= '9'; p++)
+    rounds = rounds * 10 + *p - '0';
+
+  int a[100];
+  for (int i = 0; i < 100; i++)
+    a[i] = i % 7 - 1;
+
+  long total = 0;
+  for (int r = 0; r < rounds; r++)
+    total += sum_for(a, 100) + sum_while(a, 100) + sum_do(a, 100);
+
+  if (total != (long)rounds * (195 + 210 + 195)) {
+    printf("wrong result: %ld\n", total);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Compares the time per loop iteration of rotated and unrotated loops.
+# Usage: bench/loops.sh <chibicc> [rounds]
+chibicc=$1
+rounds=${2:-100000}
+iters=$((rounds * 300))
+
+tmp=`mktemp -d /tmp/chibicc-bench-XXXXXX`
+trap 'rm -rf $tmp' INT TERM HUP EXIT
+
+elapsed() {
+    local start=$(date +%s%N)
+    "$@" || exit 1
+    echo $(( $(date +%s%N) - start ))
+}
+
+for flag in -floop-rotate -fno-loop-rotate; do
+    $chibicc $flag -o $tmp/loops$flag bench/loops.c || exit 1
+
+    # The run without rounds measures the startup cost, which is
+    # subtracted from the timed run.
+    base=$(elapsed $tmp/loops$flag 0)
+    time=$(elapsed $tmp/loops$flag $rounds)
+    awk -v f=$flag -v t=$((time - base)) -v n=$iters \
+        'BEGIN { printf "%s: %.3f ns/iteration (%d iterations)\n", f, t / n, n }'
+done
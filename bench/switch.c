@@ -0,0 +1,59 @@
+// A switch whose cost is dominated by dispatching to its cases.
+// Run with the number of rounds; each round runs 256 iterations.
+
+#include <stdio.h>
+
+int classify(int c) {
+  switch (c) {
+  case 0: return 3;
+  case 1: return 1;
+  case 2: return 4;
+  case 3: return 1;
+  case 4: return 5;
+  case 5: return 9;
+  case 6: return 2;
+  case 7: return 6;
+  case 8: return 5;
+  case 9: return 3;
+  case 10: return 5;
+  case 11: return 8;
+  case 12: return 9;
+  case 13: return 7;
+  case 14: return 9;
+  case 15: return 3;
+  case 16: return 2;
+  case 17: return 3;
+  case 18: return 8;
+  case 19: return 4;
+  case 20: return 6;
+  case 21: return 2;
+  case 22: return 6;
+  case 23: return 4;
+  case 24: return 3;
+  case 25: return 3;
+  case 26: return 8;
+  case 27: return 3;
+  case 28: return 2;
+  case 29: return 7;
+  case 30: return 9;
+  case 31: return 5;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int rounds = 0;
+  for (char *p = argc > 1 ? argv[1] : ""; '0' <= *p && *p <= '9'; p++)
+    rounds = rounds * 10 + *p - '0';
+
+  long total = 0;
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < 256; i++)
+      total += classify(i % 37);
+
+  if (total != (long)rounds * 1085) {
+    printf("wrong result: %ld\n", total);
+    return 1;
+  }
+  return 0;
+}
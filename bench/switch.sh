@@ -0,0 +1,26 @@
+#!/bin/bash
+# Compares the time per switch dispatch with and without jump tables.
+# Usage: bench/switch.sh <chibicc> [rounds]
+chibicc=$1
+rounds=${2:-100000}
+iters=$((rounds * 256))
+
+tmp=`mktemp -d /tmp/chibicc-bench-XXXXXX`
+trap 'rm -rf $tmp' INT TERM HUP EXIT
+
+elapsed() {
+    local start=$(date +%s%N)
+    "$@" || exit 1
+    echo $(( $(date +%s%N) - start ))
+}
+
+for flag in -fjump-tables -fno-jump-tables; do
+    $chibicc $flag -o $tmp/switch$flag bench/switch.c || exit 1
+
+    # The run without rounds measures the startup cost, which is
+    # subtracted from the timed run.
+    base=$(elapsed $tmp/switch$flag 0)
+    time=$(elapsed $tmp/switch$flag $rounds)
+    awk -v f=$flag -v t=$((time - base)) -v n=$iters \
+        'BEGIN { printf "%s: %.3f ns/dispatch (%d dispatches)\n", f, t / n, n }'
+done
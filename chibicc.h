@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <glob.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -29,6 +30,8 @@
 typedef struct Obj Obj;
 typedef struct Token Token;
 typedef struct VarScope VarScope;
+typedef struct TagScope TagScope;
+typedef struct Symbol Symbol;
 typedef struct Scope Scope;
 typedef struct Type Type;
 typedef struct Node Node;
@@ -48,6 +51,7 @@ typedef struct {
 
 void strarray_push(StringArray *arr, char *s);
 char *format(char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void print_json_string(FILE *out, char *s);
 
 //
 // hashmap.c
@@ -71,6 +75,7 @@ bool hashmap_put(HashMap *map, char *key, void *val);
 bool hashmap_put2(HashMap *map, char *key, int keylen, void *val);
 void hashmap_delete(HashMap *map, char *key);
 void hashmap_delete2(HashMap *map, char *key, int keylen);
+HashEntry *hashmap_next(HashMap *map, int *idx);
 void hashmap_test(void);
 
 //
@@ -129,9 +134,11 @@ char *get_string(Token *tok);
 bool equal(Token *tok, char *op);
 Token *skip(Token *tok, char *op);
 bool consume(Token **rest, Token *tok, char *str);
+void convert_pp_token(Token *tok);
 void convert_pp_tokens(Token *tok);
 File **get_input_files(void);
 File *new_file(char *name, int file_no, char *contents);
+File *add_input_file(char *path, char *contents);
 Token *tokenize_string_literal(Token *tok, Type *basety);
 Token *tokenize(File *file);
 Token *tokenize_file(char *filename);
@@ -143,11 +150,38 @@ Token *tokenize_file(char *filename);
 // preprocess.c
 //
 
+typedef struct MacroParam MacroParam;
+struct MacroParam {
+  MacroParam *next;
+  char *name;
+};
+
+typedef Token *macro_handler_fn(Token *);
+
+typedef struct Macro Macro;
+struct Macro {
+  char *name;
+  bool is_objlike; // Object-like or function-like
+  MacroParam *params;
+  char *va_args_name;
+  Token *body;
+  macro_handler_fn *handler;
+};
+
 char *search_include_paths(char *filename);
+HashMap *get_macros(void);
+HashMap *get_pragma_once(void);
+HashMap *get_include_guards(void);
+char *detect_include_guard(Token *tok);
+void set_pch_header(char *fullpath, char *guard, bool once);
 void init_macros(void);
 void define_macro(char *name, char *buf);
 void undef_macro(char *name);
 Token *preprocess(Token *tok);
+Token *preprocess_pipelined(Token *tok);
+void wait_for_tokens(Token *tok);
+void enable_macro_stats(void);
+void print_macro_stats(FILE *out, bool json);
 
 //
 // parse.c
@@ -161,6 +195,25 @@ struct VarScope{
   Type *enum_ty;
   int enum_val;
   Scope *scope;
+  Symbol *sym;
+  VarScope *shadowed; // Outer binding of the same name
+  VarScope *next;     // Next binding in the same scope
+};
+
+// Scope for struct/union/enum tags
+struct TagScope {
+  Type *ty;
+  Scope *scope;
+  Symbol *sym;
+  TagScope *shadowed;
+  TagScope *next;
+};
+
+// An identifier has a stack of bindings for each name space.
+// `var` and `tag` are the innermost ones.
+struct Symbol {
+  VarScope *var;
+  TagScope *tag;
 };
 
 // Represents a block scope.
@@ -168,9 +221,10 @@ struct Scope {
   Scope *next;
 
   // C has two block scopes; one is for variables/typedefs and
-  // the other is for struct/union/enum tags.
-  HashMap vars;
-  HashMap tags;
+  // the other is for struct/union/enum tags. These are the bindings
+  // made in this scope, which are popped when leaving the scope.
+  VarScope *vars;
+  TagScope *tags;
 };
 
 typedef enum {
@@ -210,10 +264,9 @@ struct Obj {
   Node *body;
   Obj *locals;
 
-  // Static inline function
+  // Reachability from the symbols visible from other translation units
   bool is_live;
   bool is_root;
-  StringArray refs;
 };
 
 // AST node
@@ -235,6 +288,9 @@ typedef enum {
   ND_LT,        // <
   ND_LE,        // <=
   ND_ASSIGN,    // =
+  ND_COMPOUND_ASSIGN, // op=
+  ND_PREINC,    // prefix ++ or --
+  ND_POSTINC,   // postfix ++ or --
   ND_COND,      // ?:
   ND_COMMA,     // ,
   ND_MEMBER,    // . (struct member access)
@@ -261,7 +317,8 @@ typedef enum {
   ND_NUM,       // Integer
   ND_COMPLEX,   // Constant complex number
   ND_CAST,      // Type cast
-  ND_MEMZERO,   // Zero-clear a stack variable
+  ND_MEMZERO,   // Zero-clear a stack variable or a block of memory
+  ND_MEMCPY,    // Copy a block of memory
   ND_ASM,       // "asm"
   ND_ADD_OVF,   // + Overflow checking
   ND_SUB_OVF,   // - Overflow checking
@@ -269,70 +326,93 @@ typedef enum {
 } NodeKind;
 
 // AST node type
+// The fields that only some kinds of nodes use are overlapped in
+// an anonymous union, so only the members for `kind` are valid.
 struct Node {
   NodeKind kind; // Node kind
+  bool is_reduced;
 
-  // Numeric literal
-  int64_t val;
-  double fval;
+  // Hash-consed by the reducer
+  bool is_interned;
+  bool is_canonical;
+  bool is_immutable_expr;
 
   Node *next;    // Next node
   Type *ty;      // Type, e.g. int or pointer to int
   Token *tok;    // Representative token
-  
-  bool is_reduced;
 
   Node *lhs;     // Left-hand side
   Node *rhs;     // Right-hand side
 
-  // "if" or "for" statement
-  Node *cond;
-  Node *then;
-  Node *els;
-  Node *init;
-  Node *inc;
-
-  // "break" and "continue" labels
-  char *brk_label;
-  char *cont_label;
-  bool is_resolved_cont;
-
-  // Block or statement expression
-  Node *body;
-
-  // Struct member access
-  Member *member;
-
-  // Function call
-  Type *func_ty;
-  Node *args;
-  char *cil_callsite;
-
-  // Goto or labeled statement
-  char *label;
-  char *unique_label;
-  Node *goto_next;
-  bool is_resolved_label;
-
-  // Switch
-  Node *case_next;
-  Node *default_case;
-
-  // Case
-  long begin;
-  long end;
-
-  // "asm" string literal
-  char *asm_str;
-
-  // Variable
+  // Variable, or the temporary variable of "switch"
   Obj *var;
 
-  // Sizeof
-  Type *sizeof_ty;
-
-  // Result for overflow checked calculation
-  Node *res;
+  union {
+    // Numeric literal
+    struct {
+      int64_t val;
+      double fval;
+    };
+
+    // Statements
+    struct {
+      // "switch" and "case"
+      Node *case_next;
+
+      union {
+        // "if", "for", "do", "switch" or "?:"
+        struct {
+          Node *cond;
+          Node *then;
+          Node *els;
+          Node *init;
+          Node *inc;
+
+          // "break" and "continue" labels
+          char *brk_label;
+          char *cont_label;
+          bool is_resolved_cont;
+
+          // Switch
+          Node *default_case;
+        };
+
+        // "goto", labeled statement or "case"
+        struct {
+          char *label;
+          char *unique_label;
+          Node *goto_next;
+          bool is_resolved_label;
+
+          // Case
+          long begin;
+          long end;
+        };
+      };
+    };
+
+    // Block or statement expression
+    Node *body;
+
+    // Struct member access
+    Member *member;
+
+    // Function call
+    struct {
+      Type *func_ty;
+      Node *args;
+      char *cil_callsite;
+    };
+
+    // "asm" string literal
+    char *asm_str;
+
+    // Sizeof
+    Type *sizeof_ty;
+
+    // Result for overflow checked calculation
+    Node *res;
+  };
 };
 
 Node *new_node(NodeKind kind, Token *tok);
@@ -346,6 +426,7 @@ Node *new_var_node(Obj *var, Token *tok);
 Node *new_cast(Node *expr, Type *ty);
 int64_t const_expr(Token **rest, Token *tok);
 Obj *parse(Token *tok);
+void print_ast_stats(FILE *out);
 
 //
 // type.c
@@ -409,6 +490,7 @@ struct Type {
   // Struct
   Member *members;
   bool is_flexible;
+  bool has_field_layout;   // Members are the fields of its .structure
 
   // Function type
   Type *return_ty;
@@ -492,19 +574,41 @@ Type *array_of(Type *base, int size, Token *tok);
 Type *enum_type(Token *tok);
 Type *struct_type(Token *tok);
 void add_type(Node *node);
+void print_type_stats(FILE *out);
 
 //
 // utils.c
 //
 
 int calculate_size(Type *ty);
+bool eval_for_ptr_size(Node *node, int ptr_size, int64_t *val);
 Node *align_to_node(Node *n, Node *align);
 char *to_cil_typename(Type *ty);
 bool equals_type(Type *lhs, Type *rhs);
 bool equals_node(Node *lhs, Node *rhs);
+void walk_node(Node *node, void (*visit)(Node *node));
 Node *reduce_node(Node *node);
+void print_reduce_stats(FILE *out);
 int64_t get_by_integer(Node *node);
 
+//
+// pch.c
+//
+
+void write_pch(char *path, Token *tok, char *flags, char *guard);
+Token *read_pch(char *path, char *flags);
+
+//
+// trace.c
+//
+
+extern bool is_tracing;
+
+void enable_trace(void);
+void trace_begin(char *name, char *detail);
+void trace_end(char *detail);
+void write_trace(char *path);
+
 //
 // unicode.c
 //
@@ -515,11 +619,18 @@ bool is_ident1(uint32_t c);
 bool is_ident2(uint32_t c);
 int display_width(char *p, int len);
 
+//
+// peephole.c
+//
+
+void optimize_function_body(char *buf, FILE *out, int *insns_before, int *insns_after);
+
 //
 // codegen.c
 //
 
 void codegen(Obj *prog, FILE *out);
+void print_codegen_stats(FILE *out);
 
 //
 // main.c
@@ -529,3 +640,7 @@ bool file_exists(char *path);
 
 extern StringArray include_paths;
 extern char *base_file;
+extern bool opt_floop_rotate;
+extern bool opt_fjump_tables;
+extern int opt_fcodegen_threads;
+extern bool opt_fmem_report;
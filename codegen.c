@@ -1,7 +1,24 @@
 #include "chibicc.h"
 
-static FILE *output_file;
-static Obj *current_fn;
+// The state of the function being generated. Functions are generated
+// in parallel, so each thread has its own.
+static _Thread_local FILE *output_file;
+static _Thread_local Obj *current_fn;
+static _Thread_local int lvar_offset = -1;
+static _Thread_local int label_count = 1;
+
+typedef struct TempLocal TempLocal;
+struct TempLocal {
+  TempLocal *next;
+  char *ty_name;
+  char *name;
+};
+
+static _Thread_local TempLocal *free_temps;
+static _Thread_local TempLocal *stmt_temps;
+static _Thread_local int stmt_expr_depth;
+static _Thread_local int temp_count;
+static _Thread_local int temp_decl_count;
 
 typedef struct UsingType UsingType;
 struct UsingType
@@ -12,7 +29,7 @@ struct UsingType
 
 static UsingType *using_type = NULL;
 static HashMap using_type_map;
-static int lvar_offset = -1;
+static pthread_mutex_t using_type_lock = PTHREAD_MUTEX_INITIALIZER;
 
 typedef enum {
   AS_NOTHING,
@@ -22,6 +39,8 @@ typedef enum {
 
 static void gen_expr(Node *node, bool is_bottom, bool will_discard);
 static AfterStmt gen_stmt(Node *node, bool is_bottom);
+static void gen_const_integer(Type *ty, long val);
+static char *get_member_name(Member *mem);
 
 __attribute__((format(printf, 1, 2)))
 static void println(char *fmt, ...) {
@@ -39,9 +58,10 @@ static void print(char *fmt, ...) {
   va_end(ap);
 }
 
+// Labels are numbered per function, so that the output does not
+// depend on the order in which functions are generated.
 static int count(void) {
-  static int i = 1;
-  return i++;
+  return label_count++;
 }
 
 static bool add_using_type(Type *ty) {
@@ -91,12 +111,13 @@ static void aggregate_type_recursive(Type *ty) {
   }
 }
 
+// Types are aggregated before generating functions, but some code
+// paths aggregate types on demand on the worker threads.
 static void aggregate_type(Type *ty) {
-  if (ty->is_aggregated)
-    return;
-  
-  if (add_using_type(ty))
+  pthread_mutex_lock(&using_type_lock);
+  if (!ty->is_aggregated && add_using_type(ty))
     aggregate_type_recursive(ty);
+  pthread_mutex_unlock(&using_type_lock);
 }
 
 static void make_public_type_recursive(Type *ty) {
@@ -144,6 +165,10 @@ static void make_public_type(Type *ty) {
   }
 }
 
+static bool is_direct_call(Node *node) {
+  return node->lhs->kind == ND_VAR && node->lhs->var->ty->kind == TY_FUNC;
+}
+
 static char *get_cil_callsite(Node *n) {
   if (n->cil_callsite)
     return n->cil_callsite;
@@ -165,11 +190,114 @@ static char *get_cil_callsite(Node *n) {
   return n->cil_callsite;
 }
 
-static char *gen_make_temp(Type *ty) {
-  char *name = format("__temp%d$", lvar_offset);
-  println("  .local %s %s", to_cil_typename(ty), name);
-  lvar_offset++;
-  return name;
+// Temporary locals are reused once their values are dead, so that a
+// function with many array accesses or struct-returning calls does not
+// end up with thousands of locals. A free slot is reused only for the
+// same CIL type.
+static TempLocal *alloc_temp(char *ty_name, char *prefix) {
+  temp_count++;
+  for (TempLocal **p = &free_temps; *p; p = &(*p)->next) {
+    TempLocal *temp = *p;
+    if (!strcmp(temp->ty_name, ty_name)) {
+      *p = temp->next;
+      return temp;
+    }
+  }
+
+  TempLocal *temp = calloc(1, sizeof(TempLocal));
+  temp->ty_name = ty_name;
+  temp->name = format("%s%d$", prefix, lvar_offset++);
+  println("  .local %s %s", ty_name, temp->name);
+  temp_decl_count++;
+  return temp;
+}
+
+// The value of the temp is dead.
+static void release_temp(TempLocal *temp) {
+  temp->next = free_temps;
+  free_temps = temp;
+}
+
+// The address of the temp may be used until the end of the statement.
+static void release_temp_at_stmt_end(TempLocal *temp) {
+  temp->next = stmt_temps;
+  stmt_temps = temp;
+}
+
+// Statements in a statement expression are a part of the outer
+// statement, so its temps are held until the outermost one ends.
+static void release_stmt_temps(void) {
+  if (stmt_expr_depth > 0)
+    return;
+  while (stmt_temps) {
+    TempLocal *temp = stmt_temps;
+    stmt_temps = temp->next;
+    release_temp(temp);
+  }
+}
+
+static void reset_temps(void) {
+  free_temps = NULL;
+  stmt_temps = NULL;
+  stmt_expr_depth = 0;
+  temp_count = 0;
+  temp_decl_count = 0;
+}
+
+static TempLocal *gen_make_temp(Type *ty) {
+  return alloc_temp(to_cil_typename(ty), "__temp");
+}
+
+// Under AnyCPU, a member offset that depends on the pointer size is
+// emitted as `a + b * sizeof(nuint)`, or as `v8 + (v4 - v8) * (sizeof(nuint) == 4)`.
+// The JIT folds both into a constant for the running bitness, so that
+// member access costs the same as with a fixed memory model.
+static void gen_member_offset(Node *offset) {
+  int64_t v4, v8;
+  if (mem_model != AnyCPU ||
+      !eval_for_ptr_size(offset, 4, &v4) || !eval_for_ptr_size(offset, 8, &v8) ||
+      v4 < INT32_MIN || v4 > INT32_MAX || v8 < INT32_MIN || v8 > INT32_MAX) {
+    gen_expr(offset, false, false);
+    return;
+  }
+
+  if (v4 == v8) {
+    gen_const_integer(ty_int, v4);
+    return;
+  }
+
+  println("  sizeof nuint");
+  if ((v8 - v4) % 4 == 0) {
+    int64_t b = (v8 - v4) / 4;
+    int64_t a = v4 - b * 4;
+    if (b != 1) {
+      gen_const_integer(ty_int, b);
+      println("  mul");
+    }
+    if (a) {
+      gen_const_integer(ty_int, a);
+      println("  add");
+    }
+    return;
+  }
+
+  println("  ldc.i4.4");
+  println("  ceq");
+  gen_const_integer(ty_int, v4 - v8);
+  println("  mul");
+  gen_const_integer(ty_int, v8);
+  println("  add");
+}
+
+// A member of a struct laid out the same by the CLR is accessed as
+// the field of its .structure with ldflda/ldfld/stfld, which the JIT
+// can promote, instead of with pointer arithmetic.
+// Returns NULL if the member has to be accessed by its offset.
+static char *get_field_ref(Node *node) {
+  if (node->kind != ND_MEMBER || node->member->is_bitfield ||
+      !node->lhs->ty->has_field_layout)
+    return NULL;
+  return format("%s.%s", to_cil_typename(node->lhs->ty), get_member_name(node->member));
 }
 
 // Compute the absolute address of a given node.
@@ -217,24 +345,30 @@ static void gen_addr(Node *node, bool is_bottom) {
     gen_expr(node->lhs, is_bottom, true);
     gen_addr(node->rhs, false);
     return;
-  case ND_MEMBER:
+  case ND_MEMBER: {
     gen_addr(node->lhs, is_bottom);
+    char *field = get_field_ref(node);
+    if (field) {
+      println("  ldflda %s", field);
+      return;
+    }
     // Suppress of the calculation for offset 0 might be done by reducer,
     // but ND_MEMBER is lost when suppress by reducer.
     // As a result, if special consideration is needed for member access,
     // it will be inaccessible.
     if (node->member->offset->kind != ND_NUM || node->member->offset->val != 0) {
-      gen_expr(node->member->offset, false, false);
+      gen_member_offset(node->member->offset);
       println("  add");
     }
     return;
+  }
   case ND_FUNCALL:
     gen_expr(node, is_bottom, false);
     // Will make address from lvar stored retval.
-    println("  .local %s __retval%d$", to_cil_typename(node->ty), lvar_offset);
-    println("  stloc __retval%d$", lvar_offset);
-    println("  ldloca __retval%d$", lvar_offset);
-    lvar_offset++;
+    TempLocal *temp = alloc_temp(to_cil_typename(node->ty), "__retval");
+    println("  stloc %s", temp->name);
+    println("  ldloca %s", temp->name);
+    release_temp_at_stmt_end(temp);
     return;
   }
 
@@ -243,10 +377,10 @@ static void gen_addr(Node *node, bool is_bottom) {
 
 // Made native pointer when managed pointer store into it.
 static void gen_make_ptr(Type *ty) {
-  println("  .local %s* __ptr%d$", to_cil_typename(ty), lvar_offset);
-  println("  stloc __ptr%d$", lvar_offset);
-  println("  ldloc __ptr%d$", lvar_offset);
-  lvar_offset++;
+  TempLocal *temp = alloc_temp(format("%s*", to_cil_typename(ty)), "__ptr");
+  println("  stloc %s", temp->name);
+  println("  ldloc %s", temp->name);
+  release_temp(temp);
 }
 
 // Load a value from where stack top is pointing to.
@@ -364,6 +498,115 @@ static void cmp_zero(Type *ty) {
   println("  ceq");
 }
 
+// Generate code that jumps to the label when the truth value of the
+// condition equals `jump_if`, and falls through otherwise. Conditions
+// are lowered to branches directly, without materializing 0/1 values.
+static void gen_cond(Node *node, bool is_bottom, bool jump_if, char *label) {
+  switch (node->kind) {
+  case ND_NUM:
+    if (!is_integer(node->ty))
+      break;
+    if (!node->val == !jump_if)
+      println("  br %s", label);
+    return;
+  case ND_NOT:
+    gen_cond(node->lhs, is_bottom, !jump_if, label);
+    return;
+  case ND_LOGAND:
+  case ND_LOGOR: {
+    // `a && b` jumps when false as soon as `a` is false, and `a || b`
+    // jumps when true as soon as `a` is true.
+    bool short_circuit = node->kind == ND_LOGOR;
+    if (jump_if == short_circuit) {
+      gen_cond(node->lhs, is_bottom, jump_if, label);
+      gen_cond(node->rhs, is_bottom, jump_if, label);
+      return;
+    }
+    int c = count();
+    char *skip = format("_L_skip_%d", c);
+    gen_cond(node->lhs, is_bottom, short_circuit, skip);
+    gen_cond(node->rhs, is_bottom, jump_if, label);
+    println("%s:", skip);
+    return;
+  }
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE: {
+    if (is_complex(node->lhs->ty))
+      break;
+    gen_expr(node->lhs, is_bottom, false);
+    gen_expr(node->rhs, false, false);
+
+    // The negated forms of the ordered float comparisons are the
+    // unordered ones, so that NaN operands take the false path.
+    bool is_unsigned = node->lhs->ty->is_unsigned;
+    bool is_unordered = is_unsigned || is_flonum(node->lhs->ty);
+    char *op;
+    switch (node->kind) {
+    case ND_EQ:
+      op = jump_if ? "beq" : "bne.un";
+      break;
+    case ND_NE:
+      op = jump_if ? "bne.un" : "beq";
+      break;
+    case ND_LT:
+      if (jump_if)
+        op = is_unsigned ? "blt.un" : "blt";
+      else
+        op = is_unordered ? "bge.un" : "bge";
+      break;
+    case ND_LE:
+      if (jump_if)
+        op = is_unsigned ? "ble.un" : "ble";
+      else
+        op = is_unordered ? "bgt.un" : "bgt";
+      break;
+    }
+    println("  %s %s", op, label);
+    return;
+  }
+  }
+
+  gen_expr(node, is_bottom, false);
+  if (is_flonum(node->ty)) {
+    cmp_zero(node->ty);
+    jump_if = !jump_if;
+  }
+  println("  %s %s", jump_if ? "brtrue" : "brfalse", label);
+}
+
+// Returns true if the expression can be generated twice, which is
+// the case for small expressions. Statement expressions may define
+// labels, so they are never duplicated.
+static bool is_duplicable(Node *node, int *budget) {
+  if (!node)
+    return true;
+  if (--*budget < 0)
+    return false;
+
+  switch (node->kind) {
+  case ND_STMT_EXPR:
+  case ND_ASM:
+    return false;
+  case ND_COND:
+    return is_duplicable(node->cond, budget) &&
+      is_duplicable(node->then, budget) && is_duplicable(node->els, budget);
+  case ND_FUNCALL:
+    for (Node *arg = node->args; arg; arg = arg->next)
+      if (!is_duplicable(arg, budget))
+        return false;
+    break;
+  case ND_ADD_OVF:
+  case ND_SUB_OVF:
+  case ND_MUL_OVF:
+    if (!is_duplicable(node->res, budget))
+      return false;
+    break;
+  }
+  return is_duplicable(node->lhs, budget) && is_duplicable(node->rhs, budget);
+}
+
 static void gen_const_integer(Type *ty, long val) {
   switch (ty->kind) {
     case TY_BOOL:
@@ -684,7 +927,7 @@ static void gen_funcall(Node *node, bool is_bottom, bool will_discard) {
   }
 
   // Direct call
-  if (node->lhs->kind == ND_VAR && node->lhs->var->ty->kind == TY_FUNC) {
+  if (is_direct_call(node)) {
     println("  call %s", node->lhs->var->exact_name ? node->lhs->var->exact_name : node->lhs->var->name);
   // Indirect call
   } else {
@@ -769,7 +1012,146 @@ static void gen_location(Node *node) {
       node->tok->column_no + node->tok->len - 1);
 }
 
-// If will_discard is true, the result must be discarded.
+// Apply the operator of a binary node to the operands on the stack.
+static void gen_binary_op(Node *node) {
+  switch (node->kind) {
+  case ND_ADD:
+    if (node->ty->kind == TY_FLOAT_COMPLEX)
+      println("  call __caddf");
+    else if (node->ty->kind == TY_DOUBLE_COMPLEX)
+      println("  call __cadd");
+    else
+      println("  add");
+    return;
+  case ND_SUB:
+    if (node->ty->kind == TY_FLOAT_COMPLEX)
+      println("  call __csubf");
+    else if (node->ty->kind == TY_DOUBLE_COMPLEX)
+      println("  call __csub");
+    else
+      println("  sub");
+    return;
+  case ND_MUL:
+    if (node->ty->kind == TY_FLOAT_COMPLEX)
+      println("  call __cmulf");
+    else if (node->ty->kind == TY_DOUBLE_COMPLEX)
+      println("  call __cmul");
+    else
+      println("  mul");
+    return;
+  case ND_DIV:
+    if (node->ty->kind == TY_FLOAT_COMPLEX)
+      println("  call __cdivf");
+    else if (node->ty->kind == TY_DOUBLE_COMPLEX)
+      println("  call __cdiv");
+    else if (node->ty->is_unsigned)
+      println("  div.un");
+    else
+      println("  div");
+    return;
+  case ND_MOD:
+    if (node->ty->is_unsigned)
+      println("  rem.un");
+    else
+      println("  rem");
+    return;
+  case ND_BITAND:
+    println("  and");
+    return;
+  case ND_BITOR:
+    println("  or");
+    return;
+  case ND_BITXOR:
+    println("  xor");
+    return;
+  case ND_EQ:
+    println("  ceq");
+    return;
+  case ND_NE:
+    println("  ceq");
+    println("  ldc.i4.0");
+    println("  ceq");
+    return;
+  case ND_LT:
+    if (node->lhs->ty->is_unsigned)
+      println("  clt.un");
+    else
+      println("  clt");
+    return;
+  case ND_LE:
+    if (node->lhs->ty->is_unsigned || is_flonum(node->lhs->ty))
+      println("  cgt.un");
+    else
+      println("  cgt");
+    println("  ldc.i4.0");
+    println("  ceq");
+    return;
+  case ND_SHL:
+    println("  shl");
+    return;
+  case ND_SHR:
+    if (node->lhs->ty->is_unsigned)
+      println("  shr.un");
+    else
+      println("  shr");
+    return;
+  }
+
+  error_tok(node->tok, "invalid expression");
+}
+
+// Generate `A op= C`, `++A` or `A++`. The rhs of the node is `A op C`,
+// whose operation is applied to the value of A loaded once.
+static void gen_compound_assign(Node *node, bool is_bottom, bool will_discard) {
+  Node *op = node->rhs;
+  Type *ty = node->lhs->ty;
+  bool keep_old = !will_discard && node->kind == ND_POSTINC;
+  bool keep_new = !will_discard && node->kind != ND_POSTINC;
+
+  // Update local variables and parameters in place.
+  Obj *var = node->lhs->kind == ND_VAR ? node->lhs->var : NULL;
+  if (var && (var->kind == OB_LOCAL || var->kind == OB_PARAM)) {
+    char *insn = var->kind == OB_LOCAL ? "loc" : "arg";
+    println("  ld%s %d", insn, var->offset);
+    if (keep_old)
+      println("  dup");
+    cast(ty, op->lhs->ty);
+    gen_expr(op->rhs, false, false);
+    gen_binary_op(op);
+    cast(op->ty, ty);
+    println("  st%s %d", insn, var->offset);
+    if (keep_new)
+      println("  ld%s %d", insn, var->offset);
+    return;
+  }
+
+  gen_addr(node->lhs, is_bottom);
+  if (keep_new)
+    println("  dup");
+  println("  dup");
+  load(ty);
+
+  TempLocal *temp;
+  if (keep_old) {
+    temp = gen_make_temp(ty);
+    println("  dup");
+    println("  stloc %s", temp->name);
+  }
+
+  cast(ty, op->lhs->ty);
+  gen_expr(op->rhs, false, false);
+  gen_binary_op(op);
+  cast(op->ty, ty);
+  store(ty);
+
+  if (keep_new)
+    load(ty);
+  if (keep_old) {
+    println("  ldloc %s", temp->name);
+    release_temp(temp);
+  }
+}
+
 static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
   gen_location(node);
 
@@ -850,8 +1232,15 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
     return;
   case ND_MEMBER: {
     if (!will_discard) {
+      char *field = get_field_ref(node);
+      if (field && node->ty->kind != TY_ARRAY) {
+        gen_addr(node->lhs, is_bottom);
+        println("  ldfld %s", field);
+        return;
+      }
+
       gen_addr(node, is_bottom);
-      
+
       Member *mem = node->member;
       if (mem->is_bitfield) {
         load(ty_long);
@@ -905,11 +1294,11 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
       gen_expr(node->rhs, false, false);
       println("  conv.i8");
 
-      char *temp_name;
+      TempLocal *temp;
       if (!will_discard) {
-        temp_name = gen_make_temp(ty_long);
-        println("  stloc %s", temp_name);
-        println("  ldloc %s", temp_name);
+        temp = gen_make_temp(ty_long);
+        println("  stloc %s", temp->name);
+        println("  ldloc %s", temp->name);
       }
 
       gen_const_integer(ty_long, (1L << mem->bit_width) - 1);
@@ -920,7 +1309,8 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
 
       store(ty_long);
       if (!will_discard) {
-        println("  ldloc %s", temp_name);
+        println("  ldloc %s", temp->name);
+        release_temp(temp);
         cast(ty_long, node->ty);
       }
       return;
@@ -961,6 +1351,19 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
       }
     }
 
+    // Store to the field of a struct.
+    char *field = get_field_ref(node->lhs);
+    if (field) {
+      gen_addr(node->lhs->lhs, is_bottom);
+      if (!will_discard)
+        println("  dup");
+      gen_expr(node->rhs, false, false);
+      println("  stfld %s", field);
+      if (!will_discard)
+        println("  ldfld %s", field);
+      return;
+    }
+
     // Store with indirect.
     gen_addr(node->lhs, is_bottom);
     if (!will_discard)
@@ -970,7 +1373,13 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
     if (!will_discard)
       load(node->ty);
     return;
+  case ND_COMPOUND_ASSIGN:
+  case ND_PREINC:
+  case ND_POSTINC:
+    gen_compound_assign(node, is_bottom, will_discard);
+    return;
   case ND_STMT_EXPR: {
+    stmt_expr_depth++;
     bool dead = false;
     for (Node *n = node->body; n; n = n->next) {
       if (!dead) {
@@ -989,6 +1398,7 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
       }
       is_bottom = false;
     }
+    stmt_expr_depth--;
     return;
   }
   case ND_COMMA:
@@ -1001,14 +1411,26 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
       cast(node->lhs->ty, node->ty);
     return;
   case ND_MEMZERO:
+    if (!node->var) {
+      // Zero-clear `val` bytes at the address of lhs.
+      gen_expr(node->lhs, is_bottom, false);
+      println("  ldc.i4.0");
+      println("  ldc.i4 %ld", node->val);
+      println("  initblk");
+      return;
+    }
     gen_addr(node, is_bottom);
     println("  initobj %s", to_cil_typename(node->var->ty));
     return;
+  case ND_MEMCPY:
+    gen_expr(node->lhs, is_bottom, false);
+    gen_expr(node->rhs, false, false);
+    println("  ldc.i4 %ld", node->val);
+    println("  cpblk");
+    return;
   case ND_COND: {
     int c = count();
-    gen_expr(node->cond, is_bottom, false);
-    cmp_zero(node->cond->ty);
-    println("  brtrue _L_else_%d", c);
+    gen_cond(node->cond, is_bottom, false, format("_L_else_%d", c));
     gen_expr(node->then, is_bottom, will_discard);
     println("  br _L_end_%d", c);
     println("_L_else_%d:", c);
@@ -1026,47 +1448,19 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
     if (!will_discard)
       println("  not");
     return;
-  case ND_LOGAND: {
+  case ND_LOGAND:
+  case ND_LOGOR: {
     int c = count();
     if (!will_discard) {
-      gen_expr(node->lhs, is_bottom, false);
-      cmp_zero(node->lhs->ty);
-      println("  brtrue _L_false_%d", c);
-      gen_expr(node->rhs, is_bottom, false);
-      cmp_zero(node->rhs->ty);
-      println("  brtrue.s _L_false_%d", c);
+      gen_cond(node, is_bottom, false, format("_L_false_%d", c));
       println("  ldc.i4.1");
       println("  br.s _L_end_%d", c);
       println("_L_false_%d:", c);
       println("  ldc.i4.0");
       println("_L_end_%d:", c);
     } else {
-      gen_expr(node->lhs, is_bottom, false);
-      cmp_zero(node->lhs->ty);
-      println("  brtrue _L_end_%d", c);
-      gen_expr(node->rhs, is_bottom, true);
-      println("_L_end_%d:", c);
-    }
-    return;
-  }
-  case ND_LOGOR: {
-    int c = count();
-    if (!will_discard) {
-      gen_expr(node->lhs, is_bottom, false);
-      cmp_zero(node->lhs->ty);
-      println("  brfalse _L_true_%d", c);
-      gen_expr(node->rhs, is_bottom, false);
-      cmp_zero(node->rhs->ty);
-      println("  brfalse.s _L_true_%d", c);
-      println("  ldc.i4.0");
-      println("  br.s _L_end_%d", c);
-      println("_L_true_%d:", c);
-      println("  ldc.i4.1");
-      println("_L_end_%d:", c);
-    } else {
-      gen_expr(node->lhs, is_bottom, false);
-      cmp_zero(node->lhs->ty);
-      println("  brfalse _L_end_%d", c);
+      // Only the left operand decides whether the right one is evaluated.
+      gen_cond(node->lhs, is_bottom, node->kind == ND_LOGOR, format("_L_end_%d", c));
       gen_expr(node->rhs, is_bottom, true);
       println("_L_end_%d:", c);
     }
@@ -1101,93 +1495,8 @@ static void gen_expr(Node *node, bool is_bottom, bool will_discard) {
   gen_expr(node->lhs, is_bottom, will_discard);
   gen_expr(node->rhs, false, will_discard);
 
-  if (will_discard)
-    return;
-
-  switch (node->kind) {
-  case ND_ADD:
-    if (node->ty->kind == TY_FLOAT_COMPLEX)
-      println("  call __caddf");
-    else if (node->ty->kind == TY_DOUBLE_COMPLEX)
-      println("  call __cadd");
-    else
-      println("  add");
-    return;
-  case ND_SUB:
-    if (node->ty->kind == TY_FLOAT_COMPLEX)
-      println("  call __csubf");
-    else if (node->ty->kind == TY_DOUBLE_COMPLEX)
-      println("  call __csub");
-    else
-      println("  sub");
-    return;
-  case ND_MUL:
-    if (node->ty->kind == TY_FLOAT_COMPLEX)
-      println("  call __cmulf");
-    else if (node->ty->kind == TY_DOUBLE_COMPLEX)
-      println("  call __cmul");
-    else
-      println("  mul");
-    return;
-  case ND_DIV:
-    if (node->ty->kind == TY_FLOAT_COMPLEX)
-      println("  call __cdivf");
-    else if (node->ty->kind == TY_DOUBLE_COMPLEX)
-      println("  call __cdiv");
-    else if (node->ty->is_unsigned)
-      println("  div.un");
-    else
-      println("  div");
-    return;
-  case ND_MOD:
-    if (node->ty->is_unsigned)
-      println("  rem.un");
-    else
-      println("  rem");
-    return;
-  case ND_BITAND:
-    println("  and");
-    return;
-  case ND_BITOR:
-    println("  or");
-    return;
-  case ND_BITXOR:
-    println("  xor");
-    return;
-  case ND_EQ:
-    println("  ceq");
-    return;
-  case ND_NE:
-    println("  ceq");
-    println("  ldc.i4.0");
-    println("  ceq");
-    return;
-  case ND_LT:
-    if (node->lhs->ty->is_unsigned)
-      println("  clt.un");
-    else
-      println("  clt");
-    return;
-  case ND_LE:
-    if (node->lhs->ty->is_unsigned || is_flonum(node->lhs->ty))
-      println("  cgt.un");
-    else
-      println("  cgt");
-    println("  ldc.i4.0");
-    println("  ceq");
-    return;
-  case ND_SHL:
-    println("  shl");
-    return;
-  case ND_SHR:
-    if (node->lhs->ty->is_unsigned)
-      println("  shr.un");
-    else
-      println("  shr");
-    return;
-  }
-
-  error_tok(node->tok, "invalid expression");
+  if (!will_discard)
+    gen_binary_op(node);
 }
 
 static void gen_dummy_value(Type *ty) {
@@ -1233,16 +1542,239 @@ static void gen_dummy_value(Type *ty) {
   unreachable();
 }
 
+// A case of a switch statement. `lo` and `hi` are the bounds of
+// its values, mapped so that unsigned comparison gives the order
+// of the controlling expression type.
+typedef struct {
+  uint64_t lo;
+  uint64_t hi;
+  Node *node;
+  int idx;
+} SwitchCase;
+
+// Cases in [first, last] dispatched by one test. If `is_table` is
+// true, they are dispatched by a `switch` instruction.
+typedef struct {
+  int first;
+  int last;
+  bool is_table;
+} SwitchItem;
+
+// A switch with at least this many cases in a run can be dispatched
+// by a jump table, if at least 1/SWITCH_TABLE_DENSITY of its entries
+// are case values. -fno-jump-tables disables them.
+#define SWITCH_TABLE_MIN 4
+#define SWITCH_TABLE_DENSITY 4
+
+// The number of items tested one after another at the leaves of
+// the binary search.
+#define SWITCH_LINEAR_MAX 3
+
+// Values of char, short and bool are promoted to int.
+static bool is_promoted_switch(Type *ty) {
+  return ty->kind == TY_BOOL || ty->kind == TY_CHAR || ty->kind == TY_SHORT;
+}
+
+static bool is_unsigned_switch(Type *ty) {
+  return ty->is_unsigned && !is_promoted_switch(ty);
+}
+
+static uint64_t switch_key(Type *ty, long val) {
+  if (is_promoted_switch(ty) || ty->kind == TY_INT || ty->kind == TY_ENUM)
+    val = ty->is_unsigned && !is_promoted_switch(ty) ? (long)(uint32_t)val : (long)(int32_t)val;
+  return is_unsigned_switch(ty) ? (uint64_t)val : (uint64_t)val ^ (1ULL << 63);
+}
+
+static long switch_val(Type *ty, uint64_t key) {
+  return is_unsigned_switch(ty) ? (long)key : (long)(key ^ (1ULL << 63));
+}
+
+static void gen_switch_const(Type *ty, uint64_t key) {
+  gen_const_integer(is_promoted_switch(ty) ? ty_int : ty, switch_val(ty, key));
+}
+
+// Emit the difference of two keys, which is not a key itself.
+static void gen_switch_span(Type *ty, uint64_t span) {
+  gen_const_integer(is_promoted_switch(ty) ? ty_int : ty, (long)span);
+}
+
+static void gen_switch_value(Node *node) {
+  gen_addr(node, false);
+  load(node->var->ty);
+}
+
+static int compare_switch_case(const void *a, const void *b) {
+  const SwitchCase *x = a;
+  const SwitchCase *y = b;
+  if (x->lo != y->lo)
+    return x->lo < y->lo ? -1 : 1;
+  return x->idx - y->idx;
+}
+
+// Emit a test which jumps to the case if the value matches, or
+// falls through otherwise.
+static void gen_switch_item(Node *node, SwitchCase *cases, SwitchItem *item, char *dflt) {
+  Type *ty = node->var->ty;
+  SwitchCase *first = &cases[item->first];
+
+  if (!item->is_table) {
+    gen_switch_value(node);
+    if (first->lo == first->hi) {
+      gen_switch_const(ty, first->lo);
+      println("  beq %s", first->node->label);
+      return;
+    }
+
+    // [GNU] Case ranges, tested as (value - lo) <= (hi - lo) in unsigned.
+    gen_switch_const(ty, first->lo);
+    println("  sub");
+    gen_switch_span(ty, first->hi - first->lo);
+    println("  ble.un %s", first->node->label);
+    return;
+  }
+
+  uint64_t lo = first->lo;
+  uint64_t span = cases[item->last].hi - lo;
+
+  // The `switch` instruction takes a 32-bit index, so wider values
+  // have to be checked before they are truncated.
+  int c = count();
+  bool is_wide = ty->kind == TY_LONG || ty->kind == TY_INTPTR;
+  if (is_wide) {
+    gen_switch_value(node);
+    gen_switch_const(ty, lo);
+    println("  sub");
+    gen_switch_span(ty, span);
+    println("  bgt.un _L_casenext_%d", c);
+  }
+
+  char **labels = calloc(span + 1, sizeof(char *));
+  for (int i = item->first; i <= item->last; i++)
+    for (uint64_t k = cases[i].lo - lo; k <= cases[i].hi - lo; k++)
+      labels[k] = cases[i].node->label;
+
+  gen_switch_value(node);
+  gen_switch_const(ty, lo);
+  println("  sub");
+  if (is_wide)
+    println("  conv.u4");
+  print("  switch ");
+  for (uint64_t i = 0; i <= span; i++)
+    print("%s%s", i ? "," : "", labels[i] ? labels[i] : dflt);
+  print("\n");
+  free(labels);
+
+  if (is_wide)
+    println("_L_casenext_%d:", c);
+}
+
+// Emit a balanced binary search over the items in [begin, end).
+static void gen_switch_tree(Node *node, SwitchCase *cases, SwitchItem *items, int begin, int end, char *dflt) {
+  if (end - begin <= SWITCH_LINEAR_MAX) {
+    for (int i = begin; i < end; i++)
+      gen_switch_item(node, cases, &items[i], dflt);
+    println("  br %s", dflt);
+    return;
+  }
+
+  Type *ty = node->var->ty;
+  int mid = (begin + end) / 2;
+  int c = count();
+  gen_switch_value(node);
+  gen_switch_const(ty, cases[items[mid].first].lo);
+  println("  %s _L_caseleft_%d", is_unsigned_switch(ty) ? "blt.un" : "blt", c);
+  gen_switch_tree(node, cases, items, mid, end, dflt);
+  println("_L_caseleft_%d:", c);
+  gen_switch_tree(node, cases, items, begin, mid, dflt);
+}
+
+// Dispatch a switch statement to its cases. Dense runs of cases are
+// dispatched by `switch` instructions, and they and the other cases
+// are found by a binary search on the sorted case values.
+static void gen_switch(Node *node) {
+  Type *ty = node->var->ty;
+  char *dflt = node->default_case ? node->default_case->label : node->brk_label;
+
+  int ncases = 0;
+  for (Node *n = node->case_next; n; n = n->case_next)
+    ncases++;
+
+  SwitchCase *cases = calloc(ncases, sizeof(SwitchCase));
+  SwitchItem *items = calloc(ncases, sizeof(SwitchItem));
+  bool is_sortable = true;
+  int i = 0;
+  for (Node *n = node->case_next; n; n = n->case_next, i++) {
+    cases[i] = (SwitchCase){switch_key(ty, n->begin), switch_key(ty, n->end), n, i};
+    if (cases[i].hi < cases[i].lo)
+      is_sortable = false;
+
+    // Case values of a native int type are compared in its size
+    // at runtime, so they are ordered here only if they fit in 32 bits.
+    if (ty->kind == TY_INTPTR) {
+      long min = ty->is_unsigned ? 0 : INT32_MIN;
+      if (n->begin < min || n->begin > INT32_MAX || n->end < min || n->end > INT32_MAX)
+        is_sortable = false;
+    }
+  }
+
+  if (!is_sortable) {
+    // Test cases in order.
+    for (i = 0; i < ncases; i++) {
+      items[i] = (SwitchItem){i, i, false};
+      gen_switch_item(node, cases, &items[i], dflt);
+    }
+    println("  br %s", dflt);
+    free(cases);
+    free(items);
+    return;
+  }
+
+  qsort(cases, ncases, sizeof(SwitchCase), compare_switch_case);
+  for (i = 1; i < ncases; i++)
+    if (cases[i].lo <= cases[i - 1].hi)
+      error_tok(cases[i].node->tok, "duplicate case value");
+
+  // Make the longest dense run from each case.
+  int nitems = 0;
+  for (i = 0; i < ncases;) {
+    int j = i;
+    while (opt_fjump_tables && j + 1 < ncases &&
+           cases[j + 1].hi - cases[i].lo < (uint64_t)(j + 2 - i) * SWITCH_TABLE_DENSITY)
+      j++;
+
+    if (j + 1 - i >= SWITCH_TABLE_MIN) {
+      items[nitems++] = (SwitchItem){i, j, true};
+      i = j + 1;
+    } else {
+      items[nitems++] = (SwitchItem){i, i, false};
+      i++;
+    }
+  }
+
+  gen_switch_tree(node, cases, items, 0, nitems, dflt);
+  free(cases);
+  free(items);
+}
+
 // When true is returned, the execution flow continues.
 static AfterStmt gen_stmt(Node *node, bool is_bottom) {
   gen_location(node);
+  release_stmt_temps();
 
   switch (node->kind) {
   case ND_IF: {
+    // `if (x) goto L;`, and likewise break and continue, branches
+    // to L directly instead of jumping over the goto.
+    Node *then = node->then;
+    if (then->kind == ND_BLOCK && then->body && !then->body->next)
+      then = then->body;
+    if (then->kind == ND_GOTO && !node->els) {
+      gen_cond(node->cond, is_bottom, true, then->unique_label);
+      return AS_CONTINUE;
+    }
+
     int c = count();
-    gen_expr(node->cond, is_bottom, false);
-    cmp_zero(node->cond->ty);
-    println("  brtrue _L_else_%d", c);
+    gen_cond(node->cond, is_bottom, false, format("_L_else_%d", c));
     if (gen_stmt(node->then, is_bottom) == AS_CONTINUE)
       println("  br _L_end_%d", c);
     println("_L_else_%d:", c);
@@ -1257,18 +1789,51 @@ static AfterStmt gen_stmt(Node *node, bool is_bottom) {
       if (gen_stmt(node->init, is_bottom) != AS_CONTINUE)
         unreachable();
     }
-    println("_L_begin_%d:", c);
-    if (node->cond) {
-      gen_expr(node->cond, is_bottom, false);
-      cmp_zero(node->cond->ty);
-      println("  brtrue %s", node->brk_label);
+
+    // With -fno-loop-rotate, the condition is tested at the top and
+    // each iteration ends with a jump back to it.
+    if (!opt_floop_rotate) {
+      println("_L_begin_%d:", c);
+      if (node->cond)
+        gen_cond(node->cond, is_bottom, false, node->brk_label);
+      AfterStmt req = gen_stmt(node->then, is_bottom);
+      if ((req == AS_CONTINUE) || node->is_resolved_cont) {
+        println("%s:", node->cont_label);
+        if (node->inc)
+          gen_expr(node->inc, is_bottom, true);
+        println("  br _L_begin_%d", c);
+      }
+      println("%s:", node->brk_label);
+      return AS_CONTINUE;
     }
+
+    // The loop is rotated so that the condition is tested at the bottom,
+    // and each iteration takes a single backward branch. It is entered
+    // by testing a copy of the condition, or by jumping to the test when
+    // the condition must not be duplicated.
+    int budget = 32;
+    bool is_guarded = node->cond && is_duplicable(node->cond, &budget);
+    if (is_guarded)
+      gen_cond(node->cond, is_bottom, false, node->brk_label);
+    else if (node->cond)
+      println("  br _L_cond_%d", c);
+
+    println("_L_begin_%d:", c);
     AfterStmt req = gen_stmt(node->then, is_bottom);
-    if ((req == AS_CONTINUE) || node->is_resolved_cont) {
+    bool is_looping = (req == AS_CONTINUE) || node->is_resolved_cont;
+    if (is_looping) {
       println("%s:", node->cont_label);
       if (node->inc)
         gen_expr(node->inc, is_bottom, true);
-      println("  br _L_begin_%d", c);
+    }
+    if (node->cond && !is_guarded) {
+      println("_L_cond_%d:", c);
+      gen_cond(node->cond, is_bottom, true, format("_L_begin_%d", c));
+    } else if (is_looping) {
+      if (node->cond)
+        gen_cond(node->cond, is_bottom, true, format("_L_begin_%d", c));
+      else
+        println("  br _L_begin_%d", c);
     }
     println("%s:", node->brk_label);
     return AS_CONTINUE;
@@ -1279,45 +1844,14 @@ static AfterStmt gen_stmt(Node *node, bool is_bottom) {
     AfterStmt req = gen_stmt(node->then, is_bottom);
     if ((req == AS_CONTINUE) || node->is_resolved_cont) {
       println("%s:", node->cont_label);
-      gen_expr(node->cond, is_bottom, false);
-      cmp_zero(node->cond->ty);
-      println("  brfalse _L_begin_%d", c);
+      gen_cond(node->cond, is_bottom, true, format("_L_begin_%d", c));
     }
     println("%s:", node->brk_label);
     return AS_CONTINUE;
   }
   case ND_SWITCH:
     gen_expr(node->cond, is_bottom, true);
-    char *temp_name;
-    for (Node *n = node->case_next; n; n = n->case_next) {
-      if (n->begin != n->end) {
-        temp_name = gen_make_temp(node->var->ty);
-        break;
-      }
-    }
-    for (Node *n = node->case_next; n; n = n->case_next) {
-      gen_addr(node, is_bottom);
-      load(node->var->ty);
-      if (n->begin == n->end) {
-        gen_const_integer(node->cond->ty, n->begin);
-        println("  beq %s", n->label);
-      } else {
-        // [GNU] Case ranges
-        int c = count();
-        println("  stloc %s", temp_name);
-        println("  ldloc %s", temp_name);
-        gen_const_integer(node->cond->ty, n->begin);
-        println("  blt _L_casenext_%d", c);
-        println("  ldloc %s", temp_name);
-        gen_const_integer(node->cond->ty, n->end);
-        println("  ble %s", n->label);
-        println("_L_casenext_%d:", c);
-      }
-    }
-    if (node->default_case)
-      println("  br %s", node->default_case->label);
-    else
-      println("  br %s", node->brk_label);
+    gen_switch(node);
     gen_stmt(node->then, is_bottom);
     println("%s:", node->brk_label);
     return AS_CONTINUE;
@@ -1372,6 +1906,19 @@ static AfterStmt gen_stmt(Node *node, bool is_bottom) {
   error_tok(node->tok, "invalid statement");
 }
 
+static void aggregate_node_type(Node *node) {
+  // Signatures are aggregated by get_cil_callsite() only when they are used.
+  if (node->kind == ND_FUNCALL) {
+    if (!is_direct_call(node))
+      get_cil_callsite(node);
+    return;
+  }
+  if (node->ty && node->ty->kind != TY_FUNC)
+    aggregate_type(node->ty);
+  if (node->kind == ND_SIZEOF)
+    aggregate_type(node->sizeof_ty);
+}
+
 static void aggregate_types(Obj *prog) {
   for (Obj *ob = prog; ob; ob = ob->next) {
     if (ob->kind == OB_GLOBAL_TYPE) {
@@ -1380,8 +1927,13 @@ static void aggregate_types(Obj *prog) {
       // Since the C language does not allow types to be explicitly given a scope,
       // the type of a global variable can be considered to be in a visible state.
       make_public_type(ob->ty);
+      continue;
     }
-    
+
+    // Only the types used by the live objects are emitted.
+    if (!ob->is_live)
+      continue;
+
     if (ob->is_function) {
       // Function
       aggregate_type(ob->ty->return_ty);
@@ -1401,6 +1953,15 @@ static void aggregate_types(Obj *prog) {
       aggregate_type(ob->ty);
     }
   }
+
+  // Included types only used by expressions, e.g. casts.
+  // They are aggregated after all global types are made public.
+  for (Obj *ob = prog; ob; ob = ob->next) {
+    if (ob->kind == OB_GLOBAL_TYPE || !ob->is_live)
+      continue;
+    walk_node(ob->body, aggregate_node_type);
+    walk_node(ob->init_expr, aggregate_node_type);
+  }
 }
 
 static char *safe_to_cil_typename(Type *ty) {
@@ -1446,7 +2007,7 @@ static void emit_type(Obj *prog) {
         break;
       case TY_STRUCT: {
         println(".structure %s %s", ty_scope, to_cil_typename(ty));
-        Node zero = {ND_NUM, 0};
+        Node zero = {ND_NUM};
         Node *last_offset = &zero;
         Node *last_size = &zero;
         int bit_index = 0;
@@ -1539,11 +2100,23 @@ static void assign_lvar_offsets(Obj *prog) {
   }
 }
 
+// The type of `_const_$` data of a variable. Images of variables other
+// than arrays of integers, such as string literals, are emitted as
+// byte arrays.
+static const char *to_init_data_typename(Obj *var) {
+  Type *ty = var->ty;
+  if (ty->kind == TY_ARRAY &&
+      (ty->base->kind == TY_CHAR || ty->base->kind == TY_SHORT ||
+       ty->base->kind == TY_INT || ty->base->kind == TY_LONG))
+    return to_cil_typename(ty);
+  return format("int8[%d]", var->init_data_size);
+}
+
 static void emit_data_alloc(Obj *var, bool is_static) {
   if (var->next)
     // Will make reversed order.
     emit_data_alloc(var->next, is_static);
-  if (var->is_function || !var->is_definition)
+  if (var->is_function || !var->is_definition || !var->is_live)
     return;
   if (var->is_static != is_static)
     return;
@@ -1589,25 +2162,25 @@ static void emit_non_tls_data_init(Obj *var, bool is_static) {
   if (var->next)
     // Will make reversed order.
     emit_non_tls_data_init(var->next, is_static);
-  if (var->is_function || !var->is_definition)
+  if (var->is_function || !var->is_definition || !var->is_live)
     return;
   if (var->is_static != is_static)
     return;
   if (var->is_tls)
     return;
 
-  const char *ty_name = to_cil_typename(var->ty);
-
   if (var->init_data) {
+    const char *ty_name = to_init_data_typename(var);
     println("  ldsfld %s", var->name);
     println("  ldsflda _const_$%s", var->name);
     println("  ldobj %s", ty_name);
     println("  stobj %s", ty_name);
   }
 
+  // The initializers share their locals.
   if (var->init_expr) {
-    lvar_offset = 0;
     gen_expr(var->init_expr, false, true);
+    release_stmt_temps();
   }
 }
 
@@ -1615,19 +2188,18 @@ static void emit_tls_data_init(Obj *var) {
   if (var->next)
     // Will make reversed order.
     emit_tls_data_init(var->next);
-  if (var->is_function || !var->is_definition)
+  if (var->is_function || !var->is_definition || !var->is_live)
     return;
   if (!var->is_tls)
     return;
 
-  const char *ty_name = to_cil_typename(var->ty);
-
   if (var->is_static)
     println(".function file void() __tls_init_$%s", var->name);
   else
     println(".function internal void() __tls_init_$%s", var->name);
 
   if (var->init_data) {
+    const char *ty_name = to_init_data_typename(var);
     println("  ldsfld __tls_%s__", var->name);
     println("  call __get_tls_value");
     println("  ldsflda _const_$%s", var->name);
@@ -1637,6 +2209,7 @@ static void emit_tls_data_init(Obj *var) {
 
   if (var->init_expr) {
     lvar_offset = 0;
+    reset_temps();
     gen_expr(var->init_expr, false, true);
   }
 
@@ -1645,17 +2218,18 @@ static void emit_tls_data_init(Obj *var) {
 
 static void emit_data(Obj *prog) {
   for (Obj *var = prog; var; var = var->next) {
-    if (var->is_function || !var->is_definition)
+    if (var->is_function || !var->is_definition || !var->is_live)
       continue;
 
     const char *ty_name = to_cil_typename(var->ty);
 
     if (var->init_data) {
       // TODO: Apply constant
+      const char *data_ty_name = to_init_data_typename(var);
       if (var->is_static)
-        print(".global file %s _const_$%s", ty_name, var->name);
+        print(".global file %s _const_$%s", data_ty_name, var->name);
       else
-        print(".global internal %s _const_$%s", ty_name, var->name);
+        print(".global internal %s _const_$%s", data_ty_name, var->name);
 
       for (int i = 0; i < var->init_data_size; i++)
         print(" 0x%hhx", var->init_data[i]);
@@ -1679,11 +2253,15 @@ static void emit_data(Obj *prog) {
 
   if (prog) {
     println(".initializer file");
+    lvar_offset = 0;
+    reset_temps();
     emit_data_alloc(prog, true);
     emit_non_tls_data_init(prog, true);
     println("  ret");
 
     println(".initializer internal");
+    lvar_offset = 0;
+    reset_temps();
     emit_data_alloc(prog, false);
     emit_non_tls_data_init(prog, false);
     println("  ret");
@@ -1692,91 +2270,203 @@ static void emit_data(Obj *prog) {
   }
 }
 
-static void emit_text(Obj *prog) {
-  for (Obj *fn = prog; fn; fn = fn->next) {
-    if (!fn->is_function || !fn->is_definition)
-      continue;
+// A function whose code is generated into its own buffer.
+typedef struct {
+  Obj *fn;
+  char *buf;
+  size_t len;
 
-    // No code is emitted for "static inline" functions
-    // if no one is referencing them.
-    if (!fn->is_live)
-      continue;
+  // For -fmem-report
+  int temp_count;
+  int locals_before;
+  int locals_after;
+  int insns_before;
+  int insns_after;
+} FunctionText;
 
-    if (fn->is_static)
-      print(".function file");
-    else
-      print(".function public");
+#define MAX_CODEGEN_THREADS 8
+
+static FunctionText *function_texts;
+static int function_text_count;
+static int next_function_text;
+static pthread_mutex_t function_text_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void emit_function(FunctionText *text) {
+  Obj *fn = text->fn;
+  output_file = open_memstream(&text->buf, &text->len);
+  label_count = 1;
 
-    print(" %s(", to_cil_typename(fn->ty->return_ty));
+  trace_begin("CodegenFunction", fn->name);
+
+  if (fn->is_static)
+    print(".function file");
+  else
+    print(".function public");
+
+  print(" %s(", to_cil_typename(fn->ty->return_ty));
  
-    bool first = true;
-    for (Obj *var = fn->params; var; var = var->next) {
-      if (first)
-        print("%s:%s", var->name, to_cil_typename(var->ty));
-      else
-        print(",%s:%s", var->name, to_cil_typename(var->ty));
-      first = false;
-    }
+  bool first = true;
+  for (Obj *var = fn->params; var; var = var->next) {
+    if (first)
+      print("%s:%s", var->name, to_cil_typename(var->ty));
+    else
+      print(",%s:%s", var->name, to_cil_typename(var->ty));
+    first = false;
+  }
 
-    // HACK: **VARARG**
-    // chibicc-cil handles groups of parameters as follows:
-    // * One or more fixed parameters:
-    //   * Only fixed parameters: Same as general method calls.
-    //   * Included variable parameters: Add an parameter of type `__va_arglist`.
-    // * Empty any fixed parameters:
-    //   * NET standard `vararg` calling convention is used.
-    // A function with empty fixed parameters is treated as a variadic function
-    // by C language spec. (6.7.5.3 Function declarators).
-    // In such a case, if we let the function define `__va_arglist` type parameters,
-    // it is assumed that the function will not define any parameters
-    // by mistake when the function is written in a non-chibicc implementation (such as C#).
-    // (I made a similar mistake several times when porting chibicc.)
-    // So, the `vararg` calling convention is applied only in this case,
-    // so that the caller does not have to worry about more than one argument (`__va_arglist`)
-    // being put on the stack.
-    // The reason for not using the `vararg` calling convention overall is
-    // because the `System.ArgIterator` type used by the caller to implement
-    // the `va_start` and `va_arg` macros for handling variable arguments
-    // is NOT supported by any netstandards.
-    // https://github.com/dotnet/standard/issues/20
-    if (fn->ty->is_variadic)
-    {
-      if (fn->ty->params) {
-        if (!first)
-          print(",");
-        print("C.type.__va_arglist");
-      }
+  // HACK: **VARARG**
+  // chibicc-cil handles groups of parameters as follows:
+  // * One or more fixed parameters:
+  //   * Only fixed parameters: Same as general method calls.
+  //   * Included variable parameters: Add an parameter of type `__va_arglist`.
+  // * Empty any fixed parameters:
+  //   * NET standard `vararg` calling convention is used.
+  // A function with empty fixed parameters is treated as a variadic function
+  // by C language spec. (6.7.5.3 Function declarators).
+  // In such a case, if we let the function define `__va_arglist` type parameters,
+  // it is assumed that the function will not define any parameters
+  // by mistake when the function is written in a non-chibicc implementation (such as C#).
+  // (I made a similar mistake several times when porting chibicc.)
+  // So, the `vararg` calling convention is applied only in this case,
+  // so that the caller does not have to worry about more than one argument (`__va_arglist`)
+  // being put on the stack.
+  // The reason for not using the `vararg` calling convention overall is
+  // because the `System.ArgIterator` type used by the caller to implement
+  // the `va_start` and `va_arg` macros for handling variable arguments
+  // is NOT supported by any netstandards.
+  // https://github.com/dotnet/standard/issues/20
+  if (fn->ty->is_variadic)
+  {
+    if (fn->ty->params) {
+      if (!first)
+        print(",");
+      print("C.type.__va_arglist");
     }
+  }
 
-    println(") %s", fn->name);
-    current_fn = fn;
+  println(") %s", fn->name);
+  current_fn = fn;
+
+  // The body is buffered for the peephole optimizer.
+  FILE *text_file = output_file;
+  char *body_buf;
+  size_t body_len;
+  output_file = open_memstream(&body_buf, &body_len);
+
+  // Prologue
+  lvar_offset = 0;
+  reset_temps();
+  for (Obj *var = fn->locals; var; var = var->next) {
+    if (var->name[0] != '\0')
+      println("  .local %s %s", to_cil_typename(var->ty), var->name);
+    else
+      println("  .local %s", to_cil_typename(var->ty));
+    lvar_offset++;
+  }
 
-    // Prologue
-    lvar_offset = 0;
-    for (Obj *var = fn->locals; var; var = var->next) {
-      if (var->name[0] != '\0')
-        println("  .local %s %s", to_cil_typename(var->ty), var->name);
-      else
-        println("  .local %s", to_cil_typename(var->ty));
-      lvar_offset++;
-    }
+  // Emit code
+  AfterStmt req = gen_stmt(fn->body, true);
+  if (req == AS_CONTINUE) {
+    if (fn->ty->return_ty->kind != TY_VOID)
+      // Made valid CIL sequence.
+      gen_dummy_value(fn->ty->return_ty);
+  }
 
-    // Emit code
-    AfterStmt req = gen_stmt(fn->body, true);
-    if (req == AS_CONTINUE) {
-      if (fn->ty->return_ty->kind != TY_VOID)
-        // Made valid CIL sequence.
-        gen_dummy_value(fn->ty->return_ty);
-    }
+  if (req != AS_NOTHING) {
+    // Epilogue
+    println("_L_return:");
+    println("  ret");
+  }
 
-    if (req != AS_NOTHING) {
-      // Epilogue
-      println("_L_return:");
-      println("  ret");
-    }
+  fclose(output_file);
+  output_file = text_file;
+  optimize_function_body(body_buf, output_file, &text->insns_before, &text->insns_after);
+  free(body_buf);
+
+  text->temp_count = temp_count;
+  text->locals_after = lvar_offset;
+  text->locals_before = lvar_offset - temp_decl_count + temp_count;
+
+  trace_end(NULL);
+  fclose(output_file);
+}
+
+static void *emit_function_worker(void *arg) {
+  for (;;) {
+    pthread_mutex_lock(&function_text_lock);
+    int i = next_function_text++;
+    pthread_mutex_unlock(&function_text_lock);
+
+    if (i >= function_text_count)
+      return NULL;
+    emit_function(&function_texts[i]);
   }
 }
 
+static void emit_text(Obj *prog) {
+  function_text_count = 0;
+  for (Obj *fn = prog; fn; fn = fn->next)
+    // No code is emitted for static functions
+    // if no live code is referencing them.
+    if (fn->is_function && fn->is_definition && fn->is_live)
+      function_text_count++;
+
+  function_texts = calloc(function_text_count, sizeof(FunctionText));
+  FunctionText *text = function_texts;
+  for (Obj *fn = prog; fn; fn = fn->next)
+    if (fn->is_function && fn->is_definition && fn->is_live)
+      (text++)->fn = fn;
+
+  // Functions are independent of each other, so they are generated
+  // on worker threads and concatenated in the original order. There
+  // is one thread per CPU unless -fcodegen-threads is given.
+  int nthreads = opt_fcodegen_threads ? opt_fcodegen_threads : sysconf(_SC_NPROCESSORS_ONLN);
+  nthreads = MIN(MAX(nthreads, 1), MIN(MAX_CODEGEN_THREADS, function_text_count));
+  FILE *out = output_file;
+  next_function_text = 0;
+
+  if (nthreads <= 1) {
+    emit_function_worker(NULL);
+  } else {
+    pthread_t threads[MAX_CODEGEN_THREADS];
+    for (int i = 0; i < nthreads; i++)
+      if (pthread_create(&threads[i], NULL, emit_function_worker, NULL))
+        error("cannot create a thread: %s", strerror(errno));
+    for (int i = 0; i < nthreads; i++)
+      pthread_join(threads[i], NULL);
+  }
+
+  output_file = out;
+  for (int i = 0; i < function_text_count; i++) {
+    fwrite(function_texts[i].buf, 1, function_texts[i].len, output_file);
+    free(function_texts[i].buf);
+  }
+}
+
+void print_codegen_stats(FILE *out) {
+  int before = 0;
+  int after = 0;
+  int insns_before = 0;
+  int insns_after = 0;
+  for (int i = 0; i < function_text_count; i++) {
+    FunctionText *text = &function_texts[i];
+    if (text->temp_count)
+      fprintf(out, "Locals: %s: %d before reuse, %d after\n",
+              text->fn->name, text->locals_before, text->locals_after);
+    if (text->insns_before != text->insns_after)
+      fprintf(out, "Instructions: %s: %d before peephole, %d after\n",
+              text->fn->name, text->insns_before, text->insns_after);
+    before += text->locals_before;
+    after += text->locals_after;
+    insns_before += text->insns_before;
+    insns_after += text->insns_after;
+  }
+  fprintf(out, "Locals: %d before reuse, %d after in %d functions\n",
+          before, after, function_text_count);
+  fprintf(out, "Instructions: %d before peephole, %d after in %d functions\n",
+          insns_before, insns_after, function_text_count);
+}
+
 void codegen(Obj *prog, FILE *out) {
   output_file = out;
 
@@ -1790,7 +2480,15 @@ void codegen(Obj *prog, FILE *out) {
 
   assign_lvar_offsets(prog);
   aggregate_types(prog);
+  trace_begin("EmitData", NULL);
   emit_data(prog);
+  trace_end(NULL);
+
+  trace_begin("EmitText", NULL);
   emit_text(prog);
+  trace_end(NULL);
+
+  trace_begin("EmitType", NULL);
   emit_type(prog);
+  trace_end(NULL);
 }
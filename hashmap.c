@@ -139,6 +139,19 @@ void hashmap_delete2(HashMap *map, char *key, int keylen) {
     ent->key = TOMBSTONE;
 }
 
+// Returns the next live entry at or after `*idx` and advances `*idx`
+// past it, or returns NULL if there are no more entries.
+HashEntry *hashmap_next(HashMap *map, int *idx) {
+  for (; *idx < map->capacity; (*idx)++) {
+    HashEntry *ent = &map->buckets[*idx];
+    if (ent->key && ent->key != TOMBSTONE) {
+      (*idx)++;
+      return ent;
+    }
+  }
+  return NULL;
+}
+
 void hashmap_test(void) {
   HashMap *map = calloc(1, sizeof(HashMap));
 
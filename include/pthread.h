@@ -3,8 +3,25 @@
 
 typedef void *pthread_t;
 typedef struct pthread_attr_t pthread_attr_t;
+typedef struct { void *__handle; } pthread_mutex_t;
+typedef struct { void *__handle; } pthread_cond_t;
+typedef int pthread_once_t;
+
+#define PTHREAD_MUTEX_INITIALIZER {0}
+#define PTHREAD_COND_INITIALIZER {0}
+#define PTHREAD_ONCE_INIT 0
 
 int pthread_create(pthread_t *newthread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg);
 int pthread_join(pthread_t th, void **thread_return);
+int pthread_detach(pthread_t th);
+
+int pthread_mutex_lock(pthread_mutex_t *mutex);
+int pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int pthread_cond_signal(pthread_cond_t *cond);
+int pthread_cond_broadcast(pthread_cond_t *cond);
+
+int pthread_once(pthread_once_t *once_control, void (*init_routine)(void));
 
 #endif
@@ -10,8 +10,13 @@ void free(void *p);
 
 void exit(int code);
 
+int atoi(const char *nptr);
+long strtol(const char *nptr, char **endptr, int base);
+
 int mkstemp(char *template);
 
+void qsort(void *base, size_t nmemb, size_t size, int (*compar)(const void *, const void *));
+
 int atexit(void (*)(void));
 char *getenv(const char *name);
 
@@ -4,11 +4,6 @@
 #include <time.h>
 #include <sys/types.h>
 
-struct timespec {
-  time_t tv_sec;
-  long tv_nsec;
-};
-
 struct stat {
   off_t st_size;
   struct timespec st_atim;
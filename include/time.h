@@ -2,6 +2,12 @@
 #define __TIME_H
 
 typedef long time_t;
+typedef int clockid_t;
+
+struct timespec {
+  time_t tv_sec;
+  long tv_nsec;
+};
 
 struct tm {
   int tm_sec;
@@ -20,4 +26,9 @@ struct tm *localtime(const time_t *timer);
 
 char *ctime_r(const time_t *timep, char *buf);
 
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+int clock_gettime(clockid_t clockid, struct timespec *tp);
+
 #endif
@@ -6,4 +6,8 @@ void __builtin_trap();
 int unlink(char *pathname);
 int close(int fd);
 
+#define _SC_NPROCESSORS_ONLN 84
+
+long sysconf(int name);
+
 #endif
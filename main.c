@@ -1,7 +1,7 @@
 #include "chibicc.h"
 
 typedef enum {
-  FILE_NONE, FILE_C, FILE_ASM, FILE_OBJ, FILE_AR, FILE_DSO, FILE_DLL,
+  FILE_NONE, FILE_C, FILE_C_HEADER, FILE_ASM, FILE_OBJ, FILE_AR, FILE_DSO, FILE_DLL,
 } FileType;
 
 static MemoryModel opt_mm = AnyCPU;
@@ -10,6 +10,7 @@ StringArray include_paths;
 
 static FileType opt_x;
 static StringArray opt_include;
+static char *opt_include_pch;
 static bool opt_E;
 static bool opt_M;
 static bool opt_MD;
@@ -19,8 +20,17 @@ static bool opt_S;
 static bool opt_c;
 static bool opt_cc1;
 static bool opt_hash_hash_hash;
+static bool opt_fpipeline;
+static bool opt_fmacro_stats;
+static bool opt_fmacro_stats_json;
+static bool opt_ftime_trace;
+bool opt_floop_rotate = true;
+bool opt_fjump_tables = true;
+int opt_fcodegen_threads;
+bool opt_fmem_report;
 static char *opt_MF;
 static char *opt_MT;
+static char *opt_ftime_trace_file;
 static bool opt_shared;
 static char *opt_o;
 
@@ -31,6 +41,9 @@ static StringArray system_include_paths;
 char *base_file;
 static char *output_file;
 
+// Options that a precompiled header must have been built with.
+static char *pch_flags = "";
+
 static StringArray input_paths;
 static StringArray tmpfiles;
 
@@ -43,7 +56,8 @@ static void usage(int status) {
 
 static bool take_arg(char *arg) {
   char *x[] = {
-    "-o", "-I", "-idirafter", "-include", "-x", "-MF", "-MT", "-Xlinker",
+    "-o", "-I", "-idirafter", "-include", "-include-pch", "-x", "-MF", "-MT",
+    "-Xlinker",
   };
 
   for (int i = 0; i < sizeof(x) / sizeof(*x); i++)
@@ -79,6 +93,8 @@ static void add_default_include_paths(char *argv0) {
 }
 
 static void define(char *str) {
+  pch_flags = format("%s -D%s", pch_flags, str);
+
   char *eq = strchr(str, '=');
   if (eq)
     define_macro(strndup(str, eq - str), eq + 1);
@@ -89,6 +105,8 @@ static void define(char *str) {
 static FileType parse_opt_x(char *s) {
   if (!strcmp(s, "c"))
     return FILE_C;
+  if (!strcmp(s, "c-header"))
+    return FILE_C_HEADER;
   if (!strcmp(s, "assembler"))
     return FILE_ASM;
   if (!strcmp(s, "none"))
@@ -209,11 +227,13 @@ static void parse_args(int argc, char **argv) {
     }
 
     if (!strcmp(argv[i], "-U")) {
+      pch_flags = format("%s -U%s", pch_flags, argv[i + 1]);
       undef_macro(argv[++i]);
       continue;
     }
 
     if (!strncmp(argv[i], "-U", 2)) {
+      pch_flags = format("%s %s", pch_flags, argv[i]);
       undef_macro(argv[i] + 2);
       continue;
     }
@@ -223,6 +243,11 @@ static void parse_args(int argc, char **argv) {
       continue;
     }
 
+    if (!strcmp(argv[i], "-include-pch")) {
+      opt_include_pch = argv[++i];
+      continue;
+    }
+
     if (!strcmp(argv[i], "-x")) {
       opt_x = parse_opt_x(argv[++i]);
       continue;
@@ -300,7 +325,7 @@ static void parse_args(int argc, char **argv) {
     }
 
     if (!strcmp(argv[i], "-idirafter")) {
-      strarray_push(&idirafter, argv[i++]);
+      strarray_push(&idirafter, argv[++i]);
       continue;
     }
 
@@ -327,6 +352,76 @@ static void parse_args(int argc, char **argv) {
       continue;
     }
 
+    if (!strcmp(argv[i], "-fpipeline")) {
+      opt_fpipeline = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fno-pipeline")) {
+      opt_fpipeline = false;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fmacro-stats")) {
+      opt_fmacro_stats = true;
+      opt_fmacro_stats_json = false;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fmacro-stats=json")) {
+      opt_fmacro_stats = true;
+      opt_fmacro_stats_json = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fno-macro-stats")) {
+      opt_fmacro_stats = false;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-ftime-trace")) {
+      opt_ftime_trace = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-ftime-trace=", 13)) {
+      opt_ftime_trace = true;
+      opt_ftime_trace_file = argv[i] + 13;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fmem-report")) {
+      opt_fmem_report = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-fcodegen-threads=", 18)) {
+      opt_fcodegen_threads = atoi(argv[i] + 18);
+      if (opt_fcodegen_threads < 1)
+        error("invalid number of codegen threads: %s", argv[i] + 18);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-floop-rotate")) {
+      opt_floop_rotate = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fno-loop-rotate")) {
+      opt_floop_rotate = false;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fjump-tables")) {
+      opt_fjump_tables = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fno-jump-tables")) {
+      opt_fjump_tables = false;
+      continue;
+    }
+
     if (!strcmp(argv[i], "-hashmap-test")) {
       hashmap_test();
       exit(0);
@@ -488,6 +583,15 @@ static bool in_std_include_path(char *path) {
   return false;
 }
 
+// Returns the file that files derived from the output, such as the
+// .d file of -MD, are named after. If the output goes to stdout or to
+// a device such as /dev/null, they are named after the input instead.
+static char *output_base(void) {
+  if (!opt_o || !strcmp(opt_o, "-") || !strncmp(opt_o, "/dev/", 5))
+    return base_file;
+  return opt_o;
+}
+
 // If -M options is given, the compiler write a list of input files to
 // stdout in a format that "make" command can read. This feature is
 // used to automate file dependency management.
@@ -496,7 +600,7 @@ static void print_dependencies(void) {
   if (opt_MF)
     path = opt_MF;
   else if (opt_MD)
-    path = replace_extn(opt_o ? opt_o : base_file, ".d");
+    path = replace_extn(output_base(), ".d");
   else if (opt_o)
     path = opt_o;
   else
@@ -545,8 +649,28 @@ static Token *append_tokens(Token *tok1, Token *tok2) {
   return tok1;
 }
 
+static FileType get_file_type(char *filename);
+
+// Headers found through a different search path or -include files
+// may differ, so a precompiled header must have been built with the
+// same include paths in the same order.
+static void add_include_pch_flags(void) {
+  for (int i = 0; i < include_paths.len; i++)
+    pch_flags = format("%s -I%s", pch_flags, include_paths.data[i]);
+  for (int i = 0; i < opt_include.len; i++)
+    pch_flags = format("%s -include %s", pch_flags, opt_include.data[i]);
+}
+
 static void cc1(void) {
   init_type_system(opt_mm);
+  add_include_pch_flags();
+
+  // Restore the state saved by a precompiled header. Its tokens
+  // are already preprocessed, so they are prepended to the output
+  // of the preprocessor below.
+  Token *pch_tok = NULL;
+  if (opt_include_pch)
+    pch_tok = read_pch(opt_include_pch, pch_flags);
 
   Token *tok = NULL;
 
@@ -568,9 +692,26 @@ static void cc1(void) {
   }
 
   // Tokenize and parse.
+  trace_begin("Tokenize", base_file);
   Token *tok2 = must_tokenize_file(base_file);
   tok = append_tokens(tok, tok2);
-  tok = preprocess(tok);
+  trace_end(NULL);
+
+  // A precompiled header remembers the include guard of the header
+  // so that a later #include of the same header is skipped.
+  bool is_header = get_file_type(base_file) == FILE_C_HEADER;
+  char *guard = is_header ? detect_include_guard(tok2) : NULL;
+
+  // With -fpipeline, the parser consumes declarations while the
+  // preprocessor is still producing the following ones.
+  if (opt_fpipeline && !opt_M && !opt_MD && !opt_E && !is_header) {
+    tok = preprocess_pipelined(tok);
+  } else {
+    trace_begin("Preprocess", NULL);
+    tok = preprocess(tok);
+    trace_end(NULL);
+  }
+  tok = append_tokens(pch_tok, tok);
 
   // If -M or -MD are given, print file dependencies.
   if (opt_M || opt_MD) {
@@ -585,7 +726,15 @@ static void cc1(void) {
     return;
   }
 
+  // If the input is a header, save the state as a precompiled header.
+  if (is_header) {
+    write_pch(output_file, tok, pch_flags, guard);
+    return;
+  }
+
+  trace_begin("Parse", NULL);
   Obj *prog = parse(tok);
+  trace_end(NULL);
 
   // Open a temporary output buffer.
   char *buf;
@@ -593,7 +742,9 @@ static void cc1(void) {
   FILE *output_buf = open_memstream(&buf, &buflen);
 
   // Traverse the AST to emit assembly.
+  trace_begin("Codegen", NULL);
   codegen(prog, output_buf);
+  trace_end(NULL);
   fclose(output_buf);
 
   // Write the asembly text to a file.
@@ -745,6 +896,8 @@ static FileType get_file_type(char *filename) {
     return FILE_OBJ;
   if (endswith(filename, ".c"))
     return FILE_C;
+  if (endswith(filename, ".h"))
+    return FILE_C_HEADER;
   if (endswith(filename, ".s"))
     return FILE_ASM;
 
@@ -762,7 +915,22 @@ int main(int argc, char **argv) {
 
   if (opt_cc1) {
     add_default_include_paths(argv[0]);
+    if (opt_fmacro_stats)
+      enable_macro_stats();
+    if (opt_ftime_trace)
+      enable_trace();
     cc1();
+    if (opt_fmacro_stats)
+      print_macro_stats(stderr, opt_fmacro_stats_json);
+    if (opt_fmem_report) {
+      print_ast_stats(stderr);
+      print_type_stats(stderr);
+      print_reduce_stats(stderr);
+      print_codegen_stats(stderr);
+    }
+    if (opt_ftime_trace)
+      write_trace(opt_ftime_trace_file ? opt_ftime_trace_file
+                  : replace_extn(output_base(), ".json"));
     return 0;
   }
 
@@ -795,15 +963,17 @@ int main(int argc, char **argv) {
     if (output != NULL && opt_o && (opt_c || opt_S || opt_E))
       error("cannot specify '-o' with '-c,' '-S' or '-E' with multiple files");
 
+    FileType type = get_file_type(input);
+
     if (opt_o)
       output = opt_o;
+    else if (type == FILE_C_HEADER)
+      output = replace_extn(input, ".pch");
     else if (opt_S)
       output = replace_extn(input, ".s");
     else
       output = replace_extn(input, ".o");
 
-    FileType type = get_file_type(input);
-
     // Handle .o or .a
     if (type == FILE_OBJ || type == FILE_AR || type == FILE_DSO || type == FILE_DLL) {
       strarray_push(&ld_args, input);
@@ -817,7 +987,7 @@ int main(int argc, char **argv) {
       continue;
     }
 
-    assert(type == FILE_C);
+    assert(type == FILE_C || type == FILE_C_HEADER);
 
     // Just preprocess
     if (opt_E || opt_M) {
@@ -825,6 +995,12 @@ int main(int argc, char **argv) {
       continue;
     }
 
+    // Precompile a header
+    if (type == FILE_C_HEADER) {
+      run_cc1(argc, argv, input, output);
+      continue;
+    }
+
     // Compile
     if (opt_S) {
       run_cc1(argc, argv, input, output);
@@ -67,14 +67,21 @@ static Obj *locals;
 // Likewise, global variables are accumulated to this list.
 static Obj *globals;
 
-static Scope *scope = &(Scope){};
+// All identifiers seen so far. Each has the stacks of its bindings,
+// so a lookup is a single hash table probe regardless of how deeply
+// scopes are nested.
+static HashMap symbols;
+
+static Scope global_scope;
+static Scope *scope = &global_scope;
 
 // Points to the function object the parser is currently parsing.
 static Obj *current_fn;
 
-// Lists of all goto statements and labels in the curent function.
+// List of all goto statements in the curent function, and
+// labels keyed by their names.
 static Node *gotos;
-static Node *labels;
+static HashMap labels;
 
 // Current "goto" and "continue" jump targets.
 static char *brk_label;
@@ -84,6 +91,15 @@ static Node* cont_target;
 // a switch statement. Otherwise, NULL.
 static Node *current_switch;
 
+// The last case of `current_switch`, to which a new case is appended.
+static Node *current_case;
+
+// The number of allocated nodes for -fmem-report. The preprocessor
+// thread of -fpipeline also allocates nodes to evaluate #if, so the
+// count is taken under a lock, and only if it is asked for.
+static long node_count;
+static pthread_mutex_t node_count_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static bool is_typename(Token *tok);
 static Type *declspec(Token **rest, Token *tok, VarAttr *attr);
 static Type *typename(Token **rest, Token *tok);
@@ -128,8 +144,8 @@ static Node *unary(Token **rest, Token *tok);
 static Node *primary(Token **rest, Token *tok);
 static Token *parse_typedef(Token *tok, Type *basety);
 static bool is_function(Token *tok);
-static Token *function(Token *tok, Type *basety, VarAttr *attr);
-static Token *global_variable(Token *tok, Type *basety, VarAttr *attr);
+static Token *function(Token *tok, Type *ty, VarAttr *attr);
+static Token *global_variable(Token *tok, Type *basety, Type *ty, VarAttr *attr);
 
 static Node *align_down_node(Node *n, Node *align) {
   return align_to_node(new_add(new_sub(n, align, n->tok), new_typed_num(1, ty_uintptr, n->tok), n->tok), align);
@@ -142,29 +158,45 @@ static void enter_scope(void) {
 }
 
 static void leave_scope(void) {
+  for (VarScope *sc = scope->vars; sc; sc = sc->next)
+    sc->sym->var = sc->shadowed;
+  for (TagScope *sc = scope->tags; sc; sc = sc->next)
+    sc->sym->tag = sc->shadowed;
   scope = scope->next;
 }
 
+static Symbol *get_symbol(char *name, int len) {
+  Symbol *sym = hashmap_get2(&symbols, name, len);
+  if (!sym) {
+    sym = calloc(1, sizeof(Symbol));
+    hashmap_put2(&symbols, name, len, sym);
+  }
+  return sym;
+}
+
 // Find a variable by name.
 static VarScope *find_var(Token *tok) {
-  for (Scope *sc = scope; sc; sc = sc->next) {
-    VarScope *sc2 = hashmap_get2(&sc->vars, tok->loc, tok->len);
-    if (sc2)
-      return sc2;
-  }
-  return NULL;
+  Symbol *sym = hashmap_get2(&symbols, tok->loc, tok->len);
+  return sym ? sym->var : NULL;
+}
+
+static TagScope *find_tag_scope(Token *tok) {
+  Symbol *sym = hashmap_get2(&symbols, tok->loc, tok->len);
+  return sym ? sym->tag : NULL;
 }
 
 static Type *find_tag(Token *tok) {
-  for (Scope *sc = scope; sc; sc = sc->next) {
-    Type *ty = hashmap_get2(&sc->tags, tok->loc, tok->len);
-    if (ty)
-      return ty;
-  }
-  return NULL;
+  TagScope *sc = find_tag_scope(tok);
+  return sc ? sc->ty : NULL;
 }
 
 Node *new_node(NodeKind kind, Token *tok) {
+  if (opt_fmem_report) {
+    pthread_mutex_lock(&node_count_lock);
+    node_count++;
+    pthread_mutex_unlock(&node_count_lock);
+  }
+
   Node *node = calloc(1, sizeof(Node));
   node->kind = kind;
   node->tok = tok;
@@ -240,7 +272,11 @@ Node *new_cast(Node *expr, Type *ty) {
 static VarScope *push_scope(char *name) {
   VarScope *sc = calloc(1, sizeof(VarScope));
   sc->scope = scope;
-  hashmap_put(&scope->vars, name, sc);
+  sc->sym = get_symbol(name, strlen(name));
+  sc->shadowed = sc->sym->var;
+  sc->sym->var = sc;
+  sc->next = scope->vars;
+  scope->vars = sc;
   return sc;
 }
 
@@ -362,7 +398,15 @@ static Type *find_typedef(Token *tok) {
 
 static void push_tag_scope(Token *tok, Type *ty) {
   ty->tag_name = strndup(tok->loc, tok->len);
-  hashmap_put2(&scope->tags, tok->loc, tok->len, ty);
+
+  TagScope *sc = calloc(1, sizeof(TagScope));
+  sc->ty = ty;
+  sc->scope = scope;
+  sc->sym = get_symbol(tok->loc, tok->len);
+  sc->shadowed = sc->sym->tag;
+  sc->sym->tag = sc;
+  sc->next = scope->tags;
+  scope->tags = sc;
 }
 
 // declspec = ("void" | "_Bool" | "char" | "short" | "int" | "long"
@@ -635,15 +679,14 @@ static Type *func_params(Token **rest, Token *tok, Type *ty) {
       // "array of T" is converted to "pointer to T" only in the parameter
       // context. For example, *argv[] is converted to **argv by this.
       ty2 = pointer_to(ty2->base, name);
-      ty2->name = name;
     } else if (ty2->kind == TY_FUNC) {
       // Likewise, a function is converted to a pointer to a function
       // only in the parameter context.
       ty2 = pointer_to(ty2, name);
-      ty2->name = name;
     }
 
     cur = cur->next = copy_type(ty2);
+    cur->name = name;
   }
 
   ty = func_type(ty, ty->tok);
@@ -719,6 +762,10 @@ static Type *declarator(Token **rest, Token *tok, Type *ty) {
   }
 
   ty = type_suffix(rest, tok, ty);
+
+  // Pointer and array types are shared, so name a copy of them.
+  if (ty->kind == TY_PTR || ty->kind == TY_ARRAY)
+    ty = copy_type(ty);
   ty->name = name;
   ty->name_pos = name_pos;
   return ty;
@@ -864,7 +911,10 @@ static Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr)
       continue;
     }
 
-    Obj *var = new_lvar(get_ident(ty->name), ty);
+    // Basic types such as int are shared, so the name has to be
+    // saved before the initializer declares other variables.
+    Token *name = ty->name;
+    Obj *var = new_lvar(get_ident(name), ty);
     if (attr && attr->align)
       var->align = attr->align;
 
@@ -874,9 +924,9 @@ static Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr)
     }
 
     if (ty->size->kind == ND_NUM && ty->size->val < 0)
-      error_tok(ty->name, "variable has incomplete type");
+      error_tok(name, "variable has incomplete type");
     if (var->ty->kind == TY_VOID)
-      error_tok(ty->name, "variable declared void");
+      error_tok(name, "variable declared void");
   }
 
   Node *node = new_node(ND_BLOCK, tok);
@@ -979,8 +1029,9 @@ static Member *struct_designator(Token **rest, Token *tok, Type *ty) {
     error_tok(tok, "expected a field designator");
 
   for (Member *mem = ty->members; mem; mem = mem->next) {
-    // Anonymous struct member
-    if (mem->ty->kind == TY_STRUCT && !mem->name) {
+    // Anonymous struct or union member
+    if ((mem->ty->kind == TY_STRUCT || mem->ty->kind == TY_UNION) &&
+        !mem->name) {
       if (get_struct_member(mem->ty, tok)) {
         *rest = start;
         return mem;
@@ -1309,7 +1360,257 @@ static Node *init_desg_expr(InitDesg *desg, Token *tok) {
   return new_unary(ND_DEREF, new_add(lhs, rhs, tok), tok);
 }
 
+// A scalar element of an array initializer. Constant elements are
+// packed into blobs, and the others are stored one by one.
+typedef struct {
+  Initializer *init;
+  Type *ty;
+  int offset;
+  bool is_const;
+  bool is_stored;
+} InitLeaf;
+
+// A run of constant elements is copied from a blob if it has at least
+// this many elements, and runs are split at gaps larger than this many
+// bytes.
+#define INIT_BLOB_MIN 4
+#define INIT_BLOB_GAP 16
+
+// Zero-clear gaps one by one up to this many, or the whole variable.
+#define INIT_ZERO_GAPS_MAX 4
+
+// Returns true if a constant of a given type can be written to
+// a blob. Pointers have a fixed size except in AnyCPU.
+static bool is_packable_scalar(Type *ty) {
+  switch (ty->kind) {
+  case TY_BOOL:
+  case TY_CHAR:
+  case TY_SHORT:
+  case TY_INT:
+  case TY_LONG:
+  case TY_ENUM:
+  case TY_FLOAT:
+  case TY_DOUBLE:
+  case TY_INTPTR:
+  case TY_PTR:
+    return calculate_size(ty) > 0;
+  }
+  return false;
+}
+
+// Returns the element type of a (possibly multi-dimensional) array
+// if its layout is fixed and its elements can be packed into a blob.
+static Type *packable_elem_type(Type *ty) {
+  while (ty->kind == TY_ARRAY)
+    ty = ty->base;
+  return is_packable_scalar(ty) ? ty : NULL;
+}
+
+static bool is_local_desg(InitDesg *desg) {
+  while (desg->next)
+    desg = desg->next;
+  return desg->var && desg->var->kind == OB_LOCAL;
+}
+
+static void collect_init_leaves(Initializer *init, Type *ty, int offset, InitLeaf *leaves, int *n) {
+  if (ty->kind == TY_ARRAY) {
+    int sz = calculate_size(ty->base);
+    for (int i = 0; i < ty->array_len; i++)
+      collect_init_leaves(init->children[i], ty->base, offset + sz * i, leaves, n);
+    return;
+  }
+  leaves[(*n)++] = (InitLeaf){init, ty, offset};
+}
+
+// Writes the value of `expr` converted to `ty` to `buf` if it is
+// a constant.
+static bool write_init_const(uint8_t *buf, Type *ty, Node *expr) {
+  add_type(expr);
+  if (!is_numeric(expr->ty) && expr->ty->kind != TY_PTR)
+    return false;
+
+  if (ty->kind == TY_BOOL) {
+    Node *node = reduce_node(expr);
+    if (node->kind != ND_NUM)
+      return false;
+    *buf = is_flonum(node->ty) ? node->fval != 0 : get_by_integer(node) != 0;
+    return true;
+  }
+
+  Node *node = reduce_node(new_cast(expr, ty));
+  if (node->kind != ND_NUM)
+    return false;
+
+  if (ty->kind == TY_FLOAT) {
+    float f = node->fval;
+    memcpy(buf, &f, sizeof(f));
+  } else if (ty->kind == TY_DOUBLE) {
+    double d = node->fval;
+    memcpy(buf, &d, sizeof(d));
+  } else {
+    int64_t v = node->val;
+    memcpy(buf, &v, calculate_size(ty));
+  }
+  return true;
+}
+
+// Returns a read-only global holding `len` bytes of `data`. Blobs with
+// the same contents are shared.
+static Obj *init_blob(char *data, int len, Token *tok) {
+  static HashMap blobs;
+
+  Obj *blob = hashmap_get2(&blobs, data, len);
+  if (blob)
+    return blob;
+
+  blob = new_anon_gvar(array_of(ty_char, len, tok), "init");
+  blob->init_data = data;
+  blob->init_data_size = len;
+  hashmap_put2(&blobs, data, len, blob);
+  return blob;
+}
+
+// Returns the address of the `offset`th byte of an array.
+static Node *init_desg_addr(InitDesg *desg, int offset, Token *tok) {
+  Node *addr = new_unary(ND_ADDR, init_desg_expr(desg, tok), tok);
+  addr = new_cast(addr, pointer_to(ty_char, tok));
+  if (offset == 0)
+    return addr;
+  return reduce_node(new_add(addr, new_num(offset, tok), tok));
+}
+
+static Node *init_zero(InitDesg *desg, int begin, int end, Token *tok) {
+  Node *node = new_unary(ND_MEMZERO, init_desg_addr(desg, begin, tok), tok);
+  node->val = end - begin;
+  return node;
+}
+
+static Node *append_init(Node *node, Node *expr, Token *tok) {
+  if (expr->kind == ND_NULL_EXPR)
+    return node;
+  if (node->kind == ND_NULL_EXPR)
+    return expr;
+  return new_binary(ND_COMMA, node, expr, tok);
+}
+
+static Node *create_leaf_stores(Initializer *init, Type *ty, InitDesg *desg, Token *tok, InitLeaf **leaf) {
+  Node *node = new_node(ND_NULL_EXPR, tok);
+  node->is_reduced = true;
+
+  if (ty->kind == TY_ARRAY) {
+    for (int i = 0; i < ty->array_len; i++) {
+      InitDesg desg2 = {desg, i};
+      Node *rhs = create_leaf_stores(init->children[i], ty->base, &desg2, tok, leaf);
+      node = append_init(node, rhs, tok);
+    }
+    return node;
+  }
+
+  if ((*leaf)++->is_stored)
+    return new_binary(ND_ASSIGN, init_desg_expr(desg, tok), init->expr, tok);
+  return node;
+}
+
+// Initialize an array of scalars. Runs of constant elements are copied
+// from read-only blobs, and the other elements are assigned one by one.
+// If `zero_gaps` is true, bytes not covered by them are zero-cleared.
+static Node *create_array_init(Initializer *init, Type *ty, InitDesg *desg, Token *tok, bool zero_gaps) {
+  int size = calculate_size(ty);
+  int elem_size = calculate_size(packable_elem_type(ty));
+  InitLeaf *leaves = calloc(size / elem_size, sizeof(InitLeaf));
+  int n = 0;
+  collect_init_leaves(init, ty, 0, leaves, &n);
+
+  uint8_t *buf = calloc(size, 1);
+  for (int i = 0; i < n; i++) {
+    if (leaves[i].init->expr) {
+      leaves[i].is_const = write_init_const(buf + leaves[i].offset, leaves[i].ty, leaves[i].init->expr);
+      leaves[i].is_stored = !leaves[i].is_const;
+    }
+  }
+
+  // Find runs of constants, and the gaps between what is initialized.
+  int *gaps = calloc(n + 1, sizeof(int) * 2);
+  int ngaps = 0;
+  int covered = 0;
+
+  Node *copies = new_node(ND_NULL_EXPR, tok);
+  copies->is_reduced = true;
+
+  for (int i = 0; i < n;) {
+    if (!leaves[i].init->expr) {
+      i++;
+      continue;
+    }
+
+    int begin = leaves[i].offset;
+    int last = i;
+    int nconst = 1;
+    if (leaves[i].is_const) {
+      for (int j = i + 1; j < n; j++) {
+        if (leaves[j].offset - (leaves[last].offset + elem_size) > INIT_BLOB_GAP)
+          break;
+        if (leaves[j].is_const) {
+          last = j;
+          nconst++;
+        }
+      }
+    }
+
+    if (nconst < INIT_BLOB_MIN) {
+      leaves[i].is_stored = true;
+      last = i;
+    } else {
+      int len = leaves[last].offset + elem_size - begin;
+      Obj *blob = init_blob((char *)buf + begin, len, tok);
+
+      Node *src = new_cast(new_unary(ND_ADDR, new_var_node(blob, tok), tok), pointer_to(ty_char, tok));
+      Node *node = new_binary(ND_MEMCPY, init_desg_addr(desg, begin, tok), src, tok);
+      node->val = len;
+      copies = append_init(copies, node, tok);
+    }
+
+    if (covered < begin) {
+      gaps[ngaps * 2] = covered;
+      gaps[ngaps * 2 + 1] = begin;
+      ngaps++;
+    }
+    covered = leaves[last].offset + elem_size;
+    i = last + 1;
+  }
+
+  if (covered < size) {
+    gaps[ngaps * 2] = covered;
+    gaps[ngaps * 2 + 1] = size;
+    ngaps++;
+  }
+
+  Node *node = new_node(ND_NULL_EXPR, tok);
+  node->is_reduced = true;
+
+  if (zero_gaps && ngaps) {
+    if (desg->var && (ngaps > INIT_ZERO_GAPS_MAX || gaps[1] - gaps[0] == size)) {
+      node = new_node(ND_MEMZERO, tok);
+      node->var = desg->var;
+    } else {
+      for (int i = 0; i < ngaps; i++)
+        node = append_init(node, init_zero(desg, gaps[i * 2], gaps[i * 2 + 1], tok), tok);
+    }
+  }
+
+  node = append_init(node, copies, tok);
+
+  InitLeaf *leaf = leaves;
+  node = append_init(node, create_leaf_stores(init, ty, desg, tok, &leaf), tok);
+  free(leaves);
+  free(gaps);
+  return node;
+}
+
 static Node *create_lvar_init(Initializer *init, Type *ty, InitDesg *desg, Token *tok) {
+  if (ty->kind == TY_ARRAY && packable_elem_type(ty) && is_local_desg(desg))
+    return create_array_init(init, ty, desg, tok, false);
+
   if (ty->kind == TY_ARRAY) {
     Node *node = new_node(ND_NULL_EXPR, tok);
     node->is_reduced = true;
@@ -1366,6 +1667,8 @@ static Node *lvar_initializer(Token **rest, Token *tok, Obj *var) {
       var->ty->kind != TY_STRUCT &&
       var->ty->kind != TY_UNION)
     return create_lvar_init(init, var->ty, &desg, tok);
+  else if (var->ty->kind == TY_ARRAY && packable_elem_type(var->ty))
+    return create_array_init(init, var->ty, &desg, tok, true);
   else {
     // If a partial initializer list is given, the standard requires
     // that unspecified elements are set to 0. Here, we simply
@@ -1379,33 +1682,141 @@ static Node *lvar_initializer(Token **rest, Token *tok, Obj *var) {
   }
 }
 
+// Writes the constant parts of a global initializer to `buf`, which
+// is an image of the variable. The other parts, such as addresses of
+// globals, are appended to `stores` to be assigned at startup. If `buf`
+// is NULL, all parts are appended to `stores`.
+// Returns false if the layout is not known at compile time.
+static bool write_gvar_data(Initializer *init, Type *ty, InitDesg *desg, uint8_t *buf, int offset, Node **stores, Token *tok) {
+  if (ty->kind == TY_ARRAY) {
+    int sz = calculate_size(ty->base);
+    if (sz < 0)
+      return false;
+    for (int i = 0; i < ty->array_len; i++) {
+      InitDesg desg2 = {desg, i};
+      if (!write_gvar_data(init->children[i], ty->base, &desg2, buf, offset + sz * i, stores, tok))
+        return false;
+    }
+    return true;
+  }
+
+  if ((ty->kind == TY_STRUCT && !init->expr) || ty->kind == TY_UNION) {
+    for (Member *mem = ty->members; mem; mem = mem->next) {
+      if (ty->kind == TY_UNION && mem != (init->mem ? init->mem : ty->members))
+        continue;
+      if (mem->offset->kind != ND_NUM)
+        return false;
+
+      InitDesg desg2 = {desg, 0, mem};
+      Initializer *child = init->children[mem->idx];
+      int mem_offset = offset + mem->offset->val;
+
+      if (!mem->is_bitfield) {
+        if (!write_gvar_data(child, mem->ty, &desg2, buf, mem_offset, stores, tok))
+          return false;
+        continue;
+      }
+
+      if (mem->bit_offset->kind != ND_NUM)
+        return false;
+      if (!child->expr)
+        continue;
+
+      uint8_t val[8] = {};
+      if (!buf || !write_init_const(val, ty_long, child->expr)) {
+        Node *node = new_binary(ND_ASSIGN, init_desg_expr(&desg2, tok), child->expr, tok);
+        *stores = append_init(*stores, node, tok);
+        continue;
+      }
+
+      int pos = mem_offset * 8 + mem->bit_offset->val;
+      for (int i = 0; i < mem->bit_width; i++, pos++)
+        if (val[i / 8] & (1 << (i % 8)))
+          buf[pos / 8] |= 1 << (pos % 8);
+    }
+    return true;
+  }
+
+  if (!init->expr)
+    return true;
+
+  if (buf && is_packable_scalar(ty) && write_init_const(buf + offset, ty, init->expr))
+    return true;
+
+  Node *node = new_binary(ND_ASSIGN, init_desg_expr(desg, tok), init->expr, tok);
+  *stores = append_init(*stores, node, tok);
+  return true;
+}
+
+// An image larger than this many bytes is used only if at least
+// 1/GVAR_IMAGE_DENSITY of it is non-zero. Otherwise the variable is
+// left zero-filled and the non-zero elements are assigned at startup.
+#define GVAR_IMAGE_SPARSE_MIN 256
+#define GVAR_IMAGE_DENSITY 8
+
 static void gvar_initializer(Token **rest, Token *tok, Obj *var) {
   Initializer *init = initializer(rest, tok, var->ty, &var->ty);
   InitDesg desg = {NULL, 0, NULL, var};
 
+  // If the layout of the variable is fixed, constants are evaluated
+  // at compile time into an image which is copied at startup.
+  int size = calculate_size(var->ty);
+  if (size > 0) {
+    uint8_t *buf = calloc(size, 1);
+    Node *stores = new_node(ND_NULL_EXPR, tok);
+    stores->is_reduced = true;
+
+    if (write_gvar_data(init, var->ty, &desg, buf, 0, &stores, tok)) {
+      int nonzero = 0;
+      for (int i = 0; i < size; i++)
+        if (buf[i])
+          nonzero++;
+
+      if (!nonzero) {
+        free(buf);
+      } else if (size > GVAR_IMAGE_SPARSE_MIN && nonzero * GVAR_IMAGE_DENSITY < size) {
+        free(buf);
+        stores = new_node(ND_NULL_EXPR, tok);
+        stores->is_reduced = true;
+        write_gvar_data(init, var->ty, &desg, NULL, 0, &stores, tok);
+      } else {
+        var->init_data = (char *)buf;
+        var->init_data_size = size;
+      }
+      if (stores->kind != ND_NULL_EXPR)
+        var->init_expr = reduce_node(stores);
+      return;
+    }
+    free(buf);
+  }
+
   Node *init_expr = create_lvar_init(init, var->ty, &desg, tok);
   var->init_expr = reduce_node(init_expr);
 }
 
-// Returns true if a given token represents a type.
-static bool is_typename(Token *tok) {
-  static HashMap map;
+static HashMap typename_map;
 
-  if (map.capacity == 0) {
-    static char *kw[] = {
-      "void", "_Bool", "char", "short", "int", "long", "struct", "union",
-      "typedef", "enum", "static", "extern", "_Alignas", "__builtin_va_list", "signed", "unsigned",
-      "__builtin_intptr", "__builtin_uintptr",
-      "const", "volatile", "auto", "register", "restrict", "__restrict",
-      "__restrict__", "_Noreturn", "float", "double", "typeof", "inline",
-      "_Thread_local", "__thread", "_Complex",
-    };
+static void init_typename_map(void) {
+  static char *kw[] = {
+    "void", "_Bool", "char", "short", "int", "long", "struct", "union",
+    "typedef", "enum", "static", "extern", "_Alignas", "__builtin_va_list", "signed", "unsigned",
+    "__builtin_intptr", "__builtin_uintptr",
+    "const", "volatile", "auto", "register", "restrict", "__restrict",
+    "__restrict__", "_Noreturn", "float", "double", "typeof", "inline",
+    "_Thread_local", "__thread", "_Complex",
+  };
 
-    for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-      hashmap_put(&map, kw[i], (void *)1);
-  }
+  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
+    hashmap_put(&typename_map, kw[i], (void *)1);
+}
 
-  return hashmap_get2(&map, tok->loc, tok->len) || find_typedef(tok);
+// Returns true if a given token represents a type.
+static bool is_typename(Token *tok) {
+  // The preprocessor thread may get here through #if evaluation.
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, init_typename_map);
+
+  return hashmap_get2(&typename_map, tok->loc, tok->len) || find_typedef(tok);
 }
 
 // asm-stmt = "__asm__" ("volatile" | "inline")* "(" string-literal ")"
@@ -1486,7 +1897,8 @@ static Node *stmt(Token **rest, Token *tok) {
     tok = skip(tok, ")");
 
     Node *sw = current_switch;
-    current_switch = node;
+    Node *cs = current_case;
+    current_switch = current_case = node;
 
     char *brk = brk_label;
     brk_label = node->brk_label = new_unique_name("switch_break");
@@ -1494,6 +1906,7 @@ static Node *stmt(Token **rest, Token *tok) {
     node->then = stmt(rest, tok);
 
     current_switch = sw;
+    current_case = cs;
     brk_label = brk;
     return node;
   }
@@ -1523,10 +1936,7 @@ static Node *stmt(Token **rest, Token *tok) {
     node->end = end;
 
     // Append it.
-    Node *last_case = current_switch;
-    while (last_case->case_next)
-      last_case = last_case->case_next;
-    last_case->case_next = node;
+    current_case = current_case->case_next = node;
 
     return node;
   }
@@ -1655,8 +2065,7 @@ static Node *stmt(Token **rest, Token *tok) {
     node->label = strndup(tok->loc, tok->len);
     node->unique_label = new_unique_name(node->label);
     node->lhs = stmt(rest, tok->next->next);
-    node->goto_next = labels;
-    labels = node;
+    hashmap_put(&labels, node->label, node);
     return node;
   }
 
@@ -1685,12 +2094,16 @@ static Node *compound_stmt(Token **rest, Token *tok) {
       }
 
       if (is_function(tok)) {
-        tok = function(tok, basety, &attr);
+        Type *ty = declarator(&tok, tok, basety);
+        tok = function(tok, ty, &attr);
         continue;
       }
 
       if (attr.is_extern) {
-        tok = global_variable(tok, basety, &attr);
+        if (!consume(&tok, tok, ";")) {
+          Type *ty = declarator(&tok, tok, basety);
+          tok = global_variable(tok, basety, ty, &attr);
+        }
         continue;
       }
 
@@ -1910,6 +2323,32 @@ static Node *to_assign(Node *binary) {
   return new_binary(ND_COMMA, expr1, expr2, tok);
 }
 
+// Convert `A op= C` to a node of `kind` whose rhs is `A op C`. Codegen
+// evaluates the address of A once and applies the operation to its
+// loaded value, so no pointer temporary is needed. Bitfields and
+// complex numbers are still converted by to_assign().
+static Node *to_compound_assign(NodeKind kind, Node *lhs, Node *binary) {
+  add_type(lhs);
+  add_type(binary->rhs);
+
+  if (binary->lhs != lhs ||
+      !(is_integer(lhs->ty) || is_flonum(lhs->ty) || lhs->ty->kind == TY_PTR) ||
+      (lhs->kind == ND_MEMBER && lhs->member->is_bitfield) ||
+      is_complex(binary->rhs->ty))
+    return to_assign(binary);
+
+  add_type(binary);
+
+  // The operand of ++ and -- is a constant, scaled by the size of
+  // the pointee for pointers.
+  if (kind != ND_COMPOUND_ASSIGN)
+    binary->rhs = reduce_node(binary->rhs);
+
+  Node *node = new_binary(kind, lhs, binary, binary->tok);
+  add_type(node);
+  return node;
+}
+
 // assign    = conditional (assign-op assign)?
 // assign-op = "=" | "+=" | "-=" | "*=" | "/=" | "%=" | "&=" | "|=" | "^="
 //           | "<<=" | ">>="
@@ -1920,34 +2359,34 @@ static Node *assign(Token **rest, Token *tok) {
     return new_binary(ND_ASSIGN, node, assign(rest, tok->next), tok);
 
   if (equal(tok, "+="))
-    return to_assign(new_add(node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_add(node, assign(rest, tok->next), tok));
 
   if (equal(tok, "-="))
-    return to_assign(new_sub(node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_sub(node, assign(rest, tok->next), tok));
 
   if (equal(tok, "*="))
-    return to_assign(new_binary(ND_MUL, node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_binary(ND_MUL, node, assign(rest, tok->next), tok));
 
   if (equal(tok, "/="))
-    return to_assign(new_binary(ND_DIV, node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_binary(ND_DIV, node, assign(rest, tok->next), tok));
 
   if (equal(tok, "%="))
-    return to_assign(new_binary(ND_MOD, node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_binary(ND_MOD, node, assign(rest, tok->next), tok));
 
   if (equal(tok, "&="))
-    return to_assign(new_binary(ND_BITAND, node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_binary(ND_BITAND, node, assign(rest, tok->next), tok));
 
   if (equal(tok, "|="))
-    return to_assign(new_binary(ND_BITOR, node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_binary(ND_BITOR, node, assign(rest, tok->next), tok));
 
   if (equal(tok, "^="))
-    return to_assign(new_binary(ND_BITXOR, node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_binary(ND_BITXOR, node, assign(rest, tok->next), tok));
 
   if (equal(tok, "<<="))
-    return to_assign(new_binary(ND_SHL, node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_binary(ND_SHL, node, assign(rest, tok->next), tok));
 
   if (equal(tok, ">>="))
-    return to_assign(new_binary(ND_SHR, node, assign(rest, tok->next), tok));
+    return to_compound_assign(ND_COMPOUND_ASSIGN, node, new_binary(ND_SHR, node, assign(rest, tok->next), tok));
 
   *rest = tok;
   return node;
@@ -2274,12 +2713,16 @@ static Node *unary(Token **rest, Token *tok) {
     return new_unary(ND_BITNOT, cast(rest, tok->next), tok);
 
   // Read ++i as i+=1
-  if (equal(tok, "++"))
-    return to_assign(new_add(unary(rest, tok->next), new_num(1, tok), tok));
+  if (equal(tok, "++")) {
+    Node *node = unary(rest, tok->next);
+    return to_compound_assign(ND_PREINC, node, new_add(node, new_num(1, tok), tok));
+  }
 
   // Read --i as i-=1
-  if (equal(tok, "--"))
-    return to_assign(new_sub(unary(rest, tok->next), new_num(1, tok), tok));
+  if (equal(tok, "--")) {
+    Node *node = unary(rest, tok->next);
+    return to_compound_assign(ND_PREINC, node, new_sub(node, new_num(1, tok), tok));
+  }
 
   return postfix(rest, tok);
 }
@@ -2360,7 +2803,7 @@ static Type *struct_union_decl(Token **rest, Token *tok) {
       return ty;
 
     ty = struct_type(origin);
-    static Node sizem1_node = {ND_NUM, -1};
+    static Node sizem1_node = {ND_NUM, .val = -1};
     ty->size = &sizem1_node;
 //    ty->origin_size = &sizem1_node;   // AAAA
     push_tag_scope(tag, ty);
@@ -2376,10 +2819,10 @@ static Type *struct_union_decl(Token **rest, Token *tok) {
   if (tag) {
     // If this is a redefinition, overwrite a previous type.
     // Otherwise, register the struct type.
-    Type *ty2 = hashmap_get2(&scope->tags, tag->loc, tag->len);
-    if (ty2) {
-      *ty2 = *ty;
-      return ty2;
+    TagScope *sc = find_tag_scope(tag);
+    if (sc && sc->scope == scope) {
+      *sc->ty = *ty;
+      return sc->ty;
     }
     push_tag_scope(tag, ty);
   }
@@ -2399,11 +2842,20 @@ static Node *max_node(Node *lhs, Node *rhs)
 
 static Node *reduce_and_cache_disp(Node *node) {
   node = reduce_node(node);
-  switch (node->kind) {
+  Node *expr = node;
+  while (expr->kind == ND_CAST)
+    expr = expr->lhs;
+  switch (expr->kind) {
   case ND_ADD:
   case ND_SUB:
   case ND_MUL:
   case ND_DIV:
+  case ND_MOD:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SHL:
+  case ND_SHR:
   case ND_LT:
   case ND_LE:
   case ND_COND:
@@ -2411,6 +2863,8 @@ static Node *reduce_and_cache_disp(Node *node) {
   case ND_STMT_EXPR: {
     // Cache calculated displacement into anonymous global variable (2)
     Obj *var = new_anon_gvar(node->ty, "disp");
+    // Types refer to it, and types are not walked by the reachability.
+    var->is_root = true;
     Node *node_var = new_var_node(var, NULL);
     var->init_expr = reduce_node(new_binary(ND_ASSIGN, node_var, node, NULL));
     return reduce_node(node_var);
@@ -2419,14 +2873,151 @@ static Node *reduce_and_cache_disp(Node *node) {
   return node;
 }
 
-// struct-decl = struct-union-decl
-static Type *struct_decl(Token **rest, Token *tok) {
-  Type *ty = struct_union_decl(rest, tok);
-  ty->kind = TY_STRUCT;
+// Struct layout
+//
+// Under AnyCPU, a size, an offset or an alignment depends only on
+// the pointer size, which is either 4 or 8. The layout is computed
+// for both pointer sizes and each value is expressed in the closed
+// form `a + b * sizeof(nint)`, so that layout takes linear time
+// instead of growing an expression member by member.
+#define PTR_SIZES 2
+
+static const int ptr_sizes[PTR_SIZES] = {4, 8};
+
+static int64_t align_to(int64_t n, int64_t align) {
+  return (n + align - 1) / align * align;
+}
+
+// Makes a node from the values for each pointer size.
+static Node *new_layout_node(int64_t *vals, Type *ty) {
+  if (vals[0] == vals[1])
+    return new_typed_num(vals[0], ty, NULL);
+
+  // a + b * sizeof(nint)
+  int64_t diff = ptr_sizes[1] - ptr_sizes[0];
+  if ((vals[1] - vals[0]) % diff == 0) {
+    int64_t b = (vals[1] - vals[0]) / diff;
+    int64_t a = vals[0] - b * ptr_sizes[0];
+    Node *node = new_binary(ND_MUL, new_typed_num(b, ty_uintptr, NULL), ty_uintptr->size, NULL);
+    if (a > 0)
+      node = new_binary(ND_ADD, node, new_typed_num(a, ty_uintptr, NULL), NULL);
+    else if (a < 0)
+      node = new_binary(ND_SUB, node, new_typed_num(-a, ty_uintptr, NULL), NULL);
+    return reduce_node(new_cast(node, ty));
+  }
+
+  // sizeof(nint) == 4 ? vals[0] : vals[1]
+  Node *node = new_node(ND_COND, NULL);
+  node->cond = new_binary(ND_EQ, ty_uintptr->size,
+    new_typed_num(ptr_sizes[0], ty_uintptr, NULL), NULL);
+  node->then = new_typed_num(vals[0], ty, NULL);
+  node->els = new_typed_num(vals[1], ty, NULL);
+  return reduce_node(node);
+}
 
-  if (ty->size->kind == ND_NUM && ty->size->val < 0)
-    return ty;
+typedef struct {
+  int64_t offset[PTR_SIZES];
+  int64_t bit_offset[PTR_SIZES];
+} MemberLayout;
+
+// Assigns offsets to members for each pointer size. Returns false if
+// the size or the alignment of a member can not be evaluated.
+static bool struct_layout(Type *ty) {
+  int len = 0;
+  for (Member *mem = ty->members; mem; mem = mem->next)
+    len++;
+
+  MemberLayout *layouts = calloc(len, sizeof(MemberLayout));
+  int64_t size[PTR_SIZES];
+  int64_t align[PTR_SIZES];
+
+  for (int p = 0; p < PTR_SIZES; p++) {
+    int64_t bits = 0;
+    align[p] = 1;
+
+    MemberLayout *layout = layouts;
+    for (Member *mem = ty->members; mem; mem = mem->next, layout++) {
+      int64_t sz, al;
+      if (!eval_for_ptr_size(mem->ty->size, ptr_sizes[p], &sz) ||
+          !eval_for_ptr_size(mem->align, ptr_sizes[p], &al) || al <= 0 ||
+          (mem->is_bitfield && sz <= 0)) {
+        free(layouts);
+        return false;
+      }
+
+      if (mem->is_bitfield && mem->bit_width == 0) {
+        // Zero-width anonymous bitfield has a special meaning.
+        // It affects only alignment.
+        bits = align_to(bits, sz * 8);
+      } else if (mem->is_bitfield) {
+        if (bits / (sz * 8) != (bits + mem->bit_width - 1) / (sz * 8))
+          bits = align_to(bits, sz * 8);
+        layout->offset[p] = bits / 8 / sz * sz;
+        layout->bit_offset[p] = bits % (sz * 8);
+        bits += mem->bit_width;
+      } else {
+        bits = align_to(bits, al * 8);
+        layout->offset[p] = bits / 8;
+        bits += sz * 8;
+      }
+      align[p] = MAX(align[p], al);
+    }
+    size[p] = align_to(bits, align[p] * 8) / 8;
+  }
 
+  bool is_overall_fixed_size = true;
+  MemberLayout *layout = layouts;
+  for (Member *mem = ty->members; mem; mem = mem->next, layout++) {
+    if (mem->is_bitfield && mem->bit_width == 0)
+      continue;
+    mem->offset = new_layout_node(layout->offset, ty_uintptr);
+    if (mem->is_bitfield)
+      mem->bit_offset = new_layout_node(layout->bit_offset, ty_int);
+    else
+      is_overall_fixed_size &= mem->ty->is_fixed_size;
+  }
+  free(layouts);
+
+  ty->align = new_layout_node(align, ty_uintptr);
+  ty->size = new_layout_node(size, ty_uintptr);
+  ty->is_fixed_size = is_overall_fixed_size;
+  return true;
+}
+
+static bool union_layout(Type *ty) {
+  int64_t size[PTR_SIZES];
+  int64_t align[PTR_SIZES];
+
+  for (int p = 0; p < PTR_SIZES; p++) {
+    size[p] = 0;
+    align[p] = 1;
+    for (Member *mem = ty->members; mem; mem = mem->next) {
+      int64_t sz, al;
+      if (!eval_for_ptr_size(mem->ty->size, ptr_sizes[p], &sz) ||
+          !eval_for_ptr_size(mem->align, ptr_sizes[p], &al) || al <= 0)
+        return false;
+      size[p] = MAX(size[p], sz);
+      align[p] = MAX(align[p], al);
+    }
+    size[p] = align_to(size[p], align[p]);
+  }
+
+  bool is_overall_fixed_size = true;
+  Node *node0 = new_typed_num(0, ty_uintptr, NULL);   // (size_t)0
+  for (Member *mem = ty->members; mem; mem = mem->next) {
+    mem->offset = node0;
+    is_overall_fixed_size &= mem->ty->is_fixed_size;
+  }
+
+  ty->align = new_layout_node(align, ty_uintptr);
+  ty->size = new_layout_node(size, ty_uintptr);
+  ty->is_fixed_size = is_overall_fixed_size;
+  return true;
+}
+
+// Layout with expressions, for the members whose size or alignment
+// can not be evaluated for a pointer size.
+static void struct_layout_nodes(Type *ty) {
   // Assign offsets within the struct to members.
   Node *node0 = new_typed_num(0, ty_uintptr, NULL);   // (size_t)0
   Node *node1 = new_typed_num(1, ty_uintptr, NULL);   // (size_t)1
@@ -2461,7 +3052,7 @@ static Type *struct_decl(Token **rest, Token *tok) {
           NULL);
         cond->then = align_to_node(bits, sz8);
         cond->els = bits;
-        bits = reduce_node(cond);
+        bits = reduce_and_cache_disp(cond);
 
         // mem->offset = align_down(bits / 8, sz);
         mem->offset = reduce_and_cache_disp(
@@ -2493,7 +3084,7 @@ static Type *struct_decl(Token **rest, Token *tok) {
         new_binary(ND_DIV, bits, node8, NULL));
 
       // bits = bits + mem->ty->size * 8
-      bits = reduce_node(
+      bits = reduce_and_cache_disp(
         new_binary(ND_ADD,
           bits,
           new_binary(ND_MUL, mem->ty->size, node8, NULL),
@@ -2519,18 +3110,59 @@ static Type *struct_decl(Token **rest, Token *tok) {
         NULL));
 
   ty->is_fixed_size = is_overall_fixed_size;
+}
 
-  return ty;
+// The members of a struct or union are accessed as the fields of the
+// emitted .structure only if the CLR lays them out at the same offsets.
+// Bitfields are merged into bytes and explicit alignments are not
+// emitted, and the complex types are aligned differently by the CLR.
+static bool has_field_layout(Type *ty) {
+  if (ty->is_flexible)
+    return false;
+
+  for (Member *mem = ty->members; mem; mem = mem->next) {
+    if (mem->is_bitfield || mem->is_aligning)
+      return false;
+
+    Type *mty = mem->ty;
+    for (; mty->kind == TY_ARRAY; mty = mty->base)
+      if (mty->array_len < 1)
+        return false;
+
+    switch (mty->kind) {
+    case TY_STRUCT:
+    case TY_UNION:
+      if (!mty->has_field_layout)
+        return false;
+      break;
+    case TY_FLOAT_COMPLEX:
+    case TY_DOUBLE_COMPLEX:
+      return false;
+    default:
+      if (!mty->is_fixed_size)
+        return false;
+    }
+  }
+  return true;
 }
 
-// union-decl = struct-union-decl
-static Type *union_decl(Token **rest, Token *tok) {
+// struct-decl = struct-union-decl
+static Type *struct_decl(Token **rest, Token *tok) {
   Type *ty = struct_union_decl(rest, tok);
-  ty->kind = TY_UNION;
+  ty->kind = TY_STRUCT;
 
   if (ty->size->kind == ND_NUM && ty->size->val < 0)
     return ty;
 
+  trace_begin("StructLayout", tok->kind == TK_IDENT ? get_ident(tok) : NULL);
+  if (!struct_layout(ty))
+    struct_layout_nodes(ty);
+  ty->has_field_layout = has_field_layout(ty);
+  trace_end(NULL);
+  return ty;
+}
+
+static void union_layout_nodes(Type *ty) {
   // We need to compute the alignment and the size though.
   Node *node0 = new_typed_num(0, ty_uintptr, NULL);   // (size_t)0
   Node *node1 = new_typed_num(1, ty_uintptr, NULL);   // (size_t)1
@@ -2557,7 +3189,19 @@ static Type *union_decl(Token **rest, Token *tok) {
   ty->size = reduce_and_cache_disp(align_to_node(size, ty->align));
 
   ty->is_fixed_size = is_overall_fixed_size;
+}
 
+// union-decl = struct-union-decl
+static Type *union_decl(Token **rest, Token *tok) {
+  Type *ty = struct_union_decl(rest, tok);
+  ty->kind = TY_UNION;
+
+  if (ty->size->kind == ND_NUM && ty->size->val < 0)
+    return ty;
+
+  if (!union_layout(ty))
+    union_layout_nodes(ty);
+  ty->has_field_layout = has_field_layout(ty);
   return ty;
 }
 
@@ -2613,12 +3257,14 @@ static Node *struct_ref(Node *node, Token *tok) {
   return node;
 }
 
-// Convert A++ to `(typeof A)((A += 1) - 1)`
+// Convert A++ to a node that stores `A + 1` and yields the old value of A.
+// If A can't be updated in place, convert it to `(typeof A)((A += 1) - 1)`.
 static Node *new_inc_dec(Node *node, Token *tok, int addend) {
-  add_type(node);
-  return new_cast(new_add(to_assign(new_add(node, new_num(addend, tok), tok)),
-                          new_num(-addend, tok), tok),
-                  node->ty);
+  Node *binary = addend > 0 ? new_add(node, new_num(1, tok), tok) : new_sub(node, new_num(1, tok), tok);
+  Node *inc = to_compound_assign(ND_POSTINC, node, binary);
+  if (inc->kind == ND_POSTINC)
+    return inc;
+  return new_cast(new_add(inc, new_num(-addend, tok), tok), node->ty);
 }
 
 // postfix = "(" type-name ")" "{" initializer-list "}"
@@ -2904,14 +3550,6 @@ static Node *primary(Token **rest, Token *tok) {
     VarScope *sc = find_var(tok);
     *rest = tok->next;
 
-    // For "static inline" function
-    if (sc && sc->var && sc->var->is_function) {
-      if (current_fn)
-        strarray_push(&current_fn->refs, sc->var->name);
-      else
-        sc->var->is_root = true;
-    }
-
     if (sc) {
       if (sc->var)
         return new_var_node(sc->var, tok);
@@ -2988,46 +3626,71 @@ static void create_param_lvars(Type *param) {
 // So, we need to do this after we parse the entire function.
 static void resolve_goto_labels(void) {
   for (Node *x = gotos; x; x = x->goto_next) {
-    for (Node *y = labels; y; y = y->goto_next) {
-      if (!strcmp(x->label, y->label)) {
-        x->unique_label = y->unique_label;
-        y->is_resolved_label = true;
-        break;
-      }
-    }
-
-    if (x->unique_label == NULL)
+    Node *y = hashmap_get(&labels, x->label);
+    if (!y)
       error_tok(x->tok->next, "use of undeclared label");
+    x->unique_label = y->unique_label;
+    y->is_resolved_label = true;
   }
 
-  gotos = labels = NULL;
+  gotos = NULL;
+  free(labels.buckets);
+  labels = (HashMap){};
 }
 
-static Obj *find_func(char *name) {
-  Scope *sc = scope;
-  while (sc->next)
-    sc = sc->next;
+// Whole translation unit reachability.
+// A declaration and the definition of the same symbol are distinct
+// objects, so the liveness is tracked by the symbol name.
+static HashMap live_syms;
+static HashMap global_defs;
 
-  VarScope *sc2 = hashmap_get(&sc->vars, name);
-  if (sc2 && sc2->var && sc2->var->is_function)
-    return sc2->var;
-  return NULL;
+static void mark_live(char *name);
+
+static void mark_var_live(Node *node) {
+  if (node->var && node->var->kind == OB_GLOBAL) {
+    mark_live(node->var->name);
+    if (node->var->exact_name)
+      mark_live(node->var->exact_name);
+  }
 }
 
-static void mark_live(Obj *var) {
-  if (!var->is_function || var->is_live)
+static void mark_live(char *name) {
+  if (!hashmap_put(&live_syms, name, (void *)1))
     return;
-  var->is_live = true;
 
-  for (int i = 0; i < var->refs.len; i++) {
-    Obj *fn = find_func(var->refs.data[i]);
-    if (fn)
-      mark_live(fn);
+  Obj *var = hashmap_get(&global_defs, name);
+  if (var) {
+    walk_node(var->body, mark_var_live);
+    walk_node(var->init_expr, mark_var_live);
   }
 }
 
-static Token *function(Token *tok, Type *basety, VarAttr *attr) {
-  Type *ty = declarator(&tok, tok, basety);
+// Marks the functions and variables reachable from the roots,
+// which are the symbols visible from other translation units.
+static void mark_globals_live(Obj *prog) {
+  for (Obj *var = prog; var; var = var->next)
+    if (var->kind == OB_GLOBAL && (var->body || var->init_expr))
+      hashmap_put(&global_defs, var->name, var);
+
+  for (Obj *var = prog; var; var = var->next)
+    if (var->kind == OB_GLOBAL && var->is_definition && var->is_root)
+      mark_live(var->name);
+
+  for (Obj *var = prog; var; var = var->next)
+    var->is_live = var->kind == OB_GLOBAL &&
+      (hashmap_get(&live_syms, var->name) ||
+       (var->exact_name && hashmap_get(&live_syms, var->exact_name)));
+
+  free(live_syms.buckets);
+  free(global_defs.buckets);
+  live_syms = (HashMap){};
+  global_defs = (HashMap){};
+}
+
+// `ty` is the type of the declarator that the caller has read.
+static Token *function(Token *tok, Type *ty, VarAttr *attr) {
+  trace_begin("ParseFunction", NULL);
+
   if (!ty->name)
     error_tok(ty->name_pos, "function name omitted");
 
@@ -3048,11 +3711,13 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
   fn->is_definition = !(consume(&tok, tok, ";") || consume(&tok, tok, ","));
   fn->is_static = attr->is_static || (attr->is_inline && !attr->is_extern);
   fn->is_inline = attr->is_inline;
-  fn->is_root = !(fn->is_static && fn->is_inline);
+  fn->is_root = !fn->is_static;
   fn->exact_name = exact_name;
 
-  if (!fn->is_definition)
+  if (!fn->is_definition) {
+    trace_end(fn->name);
     return tok;
+  }
 
   if (exact_name)
     error_tok(asm_tok, "could not apply exact symbol name");
@@ -3082,18 +3747,17 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
   fn->locals = locals;
   leave_scope();
   resolve_goto_labels();
+  trace_end(fn->name);
   return tok;
 }
 
-static Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
-  bool first = true;
-
-  while (!consume(&tok, tok, ";")) {
-    if (!first)
-      tok = skip(tok, ",");
-    first = false;
+// `ty` is the type of the first declarator, which the caller has
+// already read.
+static Token *global_variable(Token *tok, Type *basety, Type *ty, VarAttr *attr) {
+  trace_begin("ParseGlobalVariable", NULL);
+  char *name = NULL;
 
-    Type *ty = declarator(&tok, tok, basety);
+  for (;;) {
     if (!ty->name)
       error_tok(ty->name_pos, "variable name omitted");
 
@@ -3110,8 +3774,11 @@ static Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
     }
 
     Obj *var = new_gvar(get_ident(ty->name), ty);
+    if (!name)
+      name = var->name;
     var->is_definition = !attr->is_extern;
     var->is_static = attr->is_static;
+    var->is_root = !var->is_static;
     var->is_tls = attr->is_tls;
     if (attr->align)
       var->align = attr->align;
@@ -3123,7 +3790,13 @@ static Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
         
       gvar_initializer(&tok, tok->next, var);
     }
+
+    if (consume(&tok, tok, ";"))
+      break;
+    tok = skip(tok, ",");
+    ty = declarator(&tok, tok, basety);
   }
+  trace_end(name);
   return tok;
 }
 
@@ -3139,10 +3812,17 @@ static bool is_function(Token *tok) {
 }
 
 // program = (typedef | function-definition | global-variable)*
+void print_ast_stats(FILE *out) {
+  fprintf(out, "AST: %ld nodes, %zu bytes per node, %ld bytes in total\n",
+          node_count, sizeof(Node), node_count * (long)sizeof(Node));
+}
+
 Obj *parse(Token *tok) {
   globals = NULL;
 
   while (tok->kind != TK_EOF) {
+    wait_for_tokens(tok);
+
     VarAttr attr = {};
     Type *basety = declspec(&tok, tok, &attr);
 
@@ -3158,19 +3838,24 @@ Obj *parse(Token *tok) {
       continue;
     }
 
+    if (consume(&tok, tok, ";"))
+      continue;
+
+    // The declarator is read only once and tells whether this is
+    // a function or variables.
+    Type *ty = declarator(&tok, tok, basety);
+
     // Function
-    if (is_function(tok)) {
-      tok = function(tok, basety, &attr);
+    if (ty->kind == TY_FUNC) {
+      tok = function(tok, ty, &attr);
       continue;
     }
 
     // Global variable
-    tok = global_variable(tok, basety, &attr);
+    tok = global_variable(tok, basety, ty, &attr);
   }
+  wait_for_tokens(tok);
 
-  for (Obj *var = globals; var; var = var->next)
-    if (var->is_root)
-      mark_live(var);
-
+  mark_globals_live(globals);
   return globals;
 }
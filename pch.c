@@ -0,0 +1,541 @@
+// This file implements precompiled headers.
+//
+// A precompiled header is a cache of the preprocessor's work on a
+// header file: the macro table, the "#pragma once" and include guard
+// state, and the fully preprocessed token stream of the header.
+// Loading it restores the preprocessor state and hands the saved
+// tokens to the parser, so the header is neither read, lexed nor
+// macro-expanded again. A later #include of the header is skipped as
+// long as the header has "#pragma once" or an include guard.
+//
+// Unlike GCC or Clang, we do not save parser state. Declarations,
+// types and objects refer to each other through pointers all over
+// the parser, so the header's tokens are parsed again for every
+// translation unit.
+//
+// The file consists of arrays of fixed-size records followed by a
+// string pool. Records refer to each other and to the pool only by
+// offsets, so the file does not depend on the address it is loaded
+// at. We read the whole file into memory and point strings and source
+// file contents directly into the buffer.
+
+#include "chibicc.h"
+
+#define PCH_MAGIC "CHIBIPCH"
+#define PCH_VERSION 2
+
+// Precompiled headers are not portable across compiler builds. The
+// Makefile defines CHIBICC_BUILD_ID as a checksum of the sources.
+#ifdef CHIBICC_BUILD_ID
+#define PCH_STAMP CHIBICC_BUILD_ID
+#else
+#define PCH_STAMP __DATE__ " " __TIME__
+#endif
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t mem_model;
+  uint32_t stamp;
+  uint32_t flags;
+  uint32_t header, header_guard, header_once;
+  uint32_t files, nfiles;
+  uint32_t tokens, ntokens;
+  uint32_t macros, nmacros;
+  uint32_t params, nparams;
+  uint32_t once, nonce;
+  uint32_t guards, nguards;
+  uint32_t body, nbody;
+  uint32_t pool, size;
+} PchHeader;
+
+typedef struct {
+  uint32_t name;
+  uint32_t display_name;
+  uint32_t contents;
+  int32_t file_no;
+  int32_t line_delta;
+  bool is_input;
+} PchFile;
+
+typedef struct {
+  int64_t val;
+  double fval;
+  uint32_t file;
+  uint32_t loc;
+  uint32_t len;
+  uint32_t filename;
+  uint32_t str;
+  int32_t array_len;
+  int32_t line_no;
+  int32_t line_delta;
+  int32_t column_no;
+  uint8_t kind;
+  uint8_t ty;
+  bool at_bol;
+  bool has_space;
+} PchToken;
+
+typedef struct {
+  uint32_t name;
+  uint32_t va_args_name;
+  uint32_t params, nparams;
+  uint32_t body, nbody;
+  bool is_objlike;
+  bool is_builtin;
+} PchMacro;
+
+// Types that can be attached to a token. A string literal token
+// refers to the element type of its array type.
+static Type *token_type(int idx) {
+  Type *types[] = {
+    NULL, ty_bool, ty_char, ty_short, ty_int, ty_long,
+    ty_uchar, ty_ushort, ty_uint, ty_ulong, ty_float, ty_double,
+    ty_float_complex, ty_double_complex,
+  };
+
+  if (idx < 0 || idx >= sizeof(types) / sizeof(*types))
+    return (Type *)-1;
+  return types[idx];
+}
+
+static int token_type_index(Token *tok, Type *ty) {
+  for (int i = 0; token_type(i) != (Type *)-1; i++)
+    if (token_type(i) == ty)
+      return i;
+  error_tok(tok, "internal error: cannot save token type to a precompiled header");
+}
+
+//
+// Writer
+//
+
+typedef struct {
+  char *buf;
+  size_t len;
+  FILE *out;
+} Section;
+
+static Section files_sec, tokens_sec, macros_sec, params_sec;
+static Section once_sec, guards_sec, pool_sec;
+
+static HashMap file_index;
+static HashMap string_index;
+static int nfiles, ntokens, nparams;
+
+static void open_section(Section *sec) {
+  sec->out = open_memstream(&sec->buf, &sec->len);
+}
+
+static uint32_t section_pos(Section *sec) {
+  fflush(sec->out);
+  return sec->len;
+}
+
+// Returns a pool offset of a given byte sequence. Offset 0 is
+// reserved for NULL.
+static uint32_t write_blob(char *p, int len, int align) {
+  while (section_pos(&pool_sec) % align)
+    fputc('\0', pool_sec.out);
+
+  uint32_t off = section_pos(&pool_sec);
+  fwrite(p, len, 1, pool_sec.out);
+  return off;
+}
+
+static uint32_t write_string(char *s) {
+  if (!s)
+    return 0;
+
+  uint32_t off = (uint32_t)(size_t)hashmap_get(&string_index, s);
+  if (off)
+    return off;
+
+  off = write_blob(s, strlen(s) + 1, 1);
+  hashmap_put(&string_index, s, (void *)(size_t)off);
+  return off;
+}
+
+static bool is_input_file(File *file) {
+  File **files = get_input_files();
+  for (int i = 0; files && files[i]; i++)
+    if (files[i] == file)
+      return true;
+  return false;
+}
+
+static uint32_t write_file(File *file) {
+  static File *last_file;
+  static uint32_t last_idx;
+  if (file == last_file)
+    return last_idx;
+
+  char *key = format("%p", file);
+  uint32_t idx = (uint32_t)(size_t)hashmap_get(&file_index, key);
+
+  if (!idx) {
+    PchFile rec = {};
+    rec.name = write_string(file->name);
+    rec.display_name = write_string(file->display_name);
+    rec.contents = write_blob(file->contents, strlen(file->contents) + 1, 1);
+    rec.file_no = file->file_no;
+    rec.line_delta = file->line_delta;
+    rec.is_input = is_input_file(file);
+    fwrite(&rec, sizeof(rec), 1, files_sec.out);
+
+    idx = ++nfiles;
+    hashmap_put(&file_index, key, (void *)(size_t)idx);
+  }
+
+  last_file = file;
+  last_idx = idx - 1;
+  return last_idx;
+}
+
+// Writes a token list up to and including the terminating EOF
+// and returns the number of written tokens.
+static uint32_t write_tokens(Token *tok) {
+  int n = 0;
+
+  for (;; tok = tok->next) {
+    PchToken rec = {};
+    rec.kind = tok->kind;
+    rec.file = write_file(tok->file);
+
+    if (tok->loc < tok->file->contents)
+      error_tok(tok, "internal error: token is not in its source file");
+    rec.loc = tok->loc - tok->file->contents;
+
+    rec.len = tok->len;
+    rec.val = tok->val;
+    rec.fval = tok->fval;
+    rec.filename = write_string(tok->filename);
+    rec.line_no = tok->line_no;
+    rec.line_delta = tok->line_delta;
+    rec.column_no = tok->column_no;
+    rec.at_bol = tok->at_bol;
+    rec.has_space = tok->has_space;
+
+    if (tok->kind == TK_STR) {
+      int size = get_by_integer(tok->ty->base->size);
+      rec.ty = token_type_index(tok, tok->ty->base);
+      rec.array_len = tok->ty->array_len;
+      rec.str = write_blob(tok->str, rec.array_len * size, size);
+    } else if (tok->ty) {
+      rec.ty = token_type_index(tok, tok->ty);
+    }
+
+    fwrite(&rec, sizeof(rec), 1, tokens_sec.out);
+    n++;
+
+    if (tok->kind == TK_EOF)
+      return n;
+  }
+}
+
+static void write_macro(Macro *m) {
+  PchMacro rec = {};
+  rec.name = write_string(m->name);
+  rec.va_args_name = write_string(m->va_args_name);
+  rec.is_objlike = m->is_objlike;
+  rec.is_builtin = m->handler != NULL;
+
+  rec.params = nparams;
+  for (MacroParam *p = m->params; p; p = p->next) {
+    uint32_t off = write_string(p->name);
+    fwrite(&off, sizeof(off), 1, params_sec.out);
+    rec.nparams++;
+    nparams++;
+  }
+
+  if (m->body) {
+    rec.body = ntokens;
+    rec.nbody = write_tokens(m->body);
+    ntokens += rec.nbody;
+  }
+
+  fwrite(&rec, sizeof(rec), 1, macros_sec.out);
+}
+
+static uint32_t align_pos(FILE *out, uint32_t pos) {
+  for (; pos % 16; pos++)
+    fputc('\0', out);
+  return pos;
+}
+
+static uint32_t copy_section(FILE *out, Section *sec, uint32_t *pos) {
+  fclose(sec->out);
+  *pos = align_pos(out, *pos);
+  uint32_t start = *pos;
+  fwrite(sec->buf, sec->len, 1, out);
+  *pos += sec->len;
+  return start;
+}
+
+static char *header_fullpath(void) {
+  File **files = get_input_files();
+  for (int i = 0; files[i]; i++)
+    if (!strcmp(files[i]->name, base_file))
+      return files[i]->fullpath;
+  return base_file;
+}
+
+void write_pch(char *path, Token *tok, char *flags, char *guard) {
+  open_section(&files_sec);
+  open_section(&tokens_sec);
+  open_section(&macros_sec);
+  open_section(&params_sec);
+  open_section(&once_sec);
+  open_section(&guards_sec);
+  open_section(&pool_sec);
+  fputc('\0', pool_sec.out);
+
+  PchHeader hdr = {};
+  memcpy(hdr.magic, PCH_MAGIC, sizeof(hdr.magic));
+  hdr.version = PCH_VERSION;
+  hdr.mem_model = mem_model;
+  hdr.stamp = write_string(PCH_STAMP);
+  hdr.flags = write_string(flags);
+  hdr.header = write_string(header_fullpath());
+  hdr.header_guard = guard ? write_string(guard) : 0;
+  hdr.header_once = hashmap_get(get_pragma_once(), base_file) != NULL;
+
+  hdr.body = ntokens;
+  hdr.nbody = write_tokens(tok);
+  ntokens += hdr.nbody;
+
+  HashMap *macros = get_macros();
+  for (int i = 0; hashmap_next(macros, &i);) {
+    write_macro(macros->buckets[i - 1].val);
+    hdr.nmacros++;
+  }
+
+  HashMap *pragma_once = get_pragma_once();
+  for (int i = 0; hashmap_next(pragma_once, &i);) {
+    uint32_t off = write_string(pragma_once->buckets[i - 1].key);
+    fwrite(&off, sizeof(off), 1, once_sec.out);
+    hdr.nonce++;
+  }
+
+  HashMap *guards = get_include_guards();
+  for (int i = 0; hashmap_next(guards, &i);) {
+    uint32_t off[] = {
+      write_string(guards->buckets[i - 1].key),
+      write_string(guards->buckets[i - 1].val),
+    };
+    fwrite(off, sizeof(off), 1, guards_sec.out);
+    hdr.nguards++;
+  }
+
+  hdr.nfiles = nfiles;
+  hdr.ntokens = ntokens;
+  hdr.nparams = nparams;
+
+  char *buf;
+  size_t buflen;
+  FILE *out = open_memstream(&buf, &buflen);
+  uint32_t pos = sizeof(hdr);
+  fwrite(&hdr, sizeof(hdr), 1, out);
+
+  hdr.files = copy_section(out, &files_sec, &pos);
+  hdr.tokens = copy_section(out, &tokens_sec, &pos);
+  hdr.macros = copy_section(out, &macros_sec, &pos);
+  hdr.params = copy_section(out, &params_sec, &pos);
+  hdr.once = copy_section(out, &once_sec, &pos);
+  hdr.guards = copy_section(out, &guards_sec, &pos);
+  hdr.pool = copy_section(out, &pool_sec, &pos);
+  hdr.size = pos;
+  fclose(out);
+
+  // Now that we know where each section lives, rewrite the header.
+  memcpy(buf, &hdr, sizeof(hdr));
+
+  FILE *fp = (!path || !strcmp(path, "-")) ? stdout : fopen(path, "wb");
+  if (!fp)
+    error("cannot open output file: %s: %s", path, strerror(errno));
+  fwrite(buf, buflen, 1, fp);
+  fclose(fp);
+}
+
+//
+// Reader
+//
+
+static char *pch_path;
+static char *base;
+static PchHeader *header;
+static File **files;
+static Token *tokens;
+
+static char *read_string(uint32_t off) {
+  return off ? base + header->pool + off : NULL;
+}
+
+static File *load_file(PchFile *rec) {
+  char *name = read_string(rec->name);
+  char *contents = read_string(rec->contents);
+
+  File *file;
+  if (rec->is_input) {
+    file = add_input_file(name, contents);
+  } else {
+    file = new_file(name, rec->file_no, contents);
+  }
+
+  file->display_name = read_string(rec->display_name);
+  file->line_delta = rec->line_delta;
+  return file;
+}
+
+static void load_token(Token *tok, PchToken *rec) {
+  if (rec->file >= header->nfiles)
+    error("%s: corrupted precompiled header", pch_path);
+
+  tok->kind = rec->kind;
+  tok->file = files[rec->file];
+  tok->loc = tok->file->contents + rec->loc;
+  tok->len = rec->len;
+  tok->val = rec->val;
+  tok->fval = rec->fval;
+  tok->filename = read_string(rec->filename);
+  tok->line_no = rec->line_no;
+  tok->line_delta = rec->line_delta;
+  tok->column_no = rec->column_no;
+  tok->at_bol = rec->at_bol;
+  tok->has_space = rec->has_space;
+
+  Type *ty = token_type(rec->ty);
+  if (ty == (Type *)-1)
+    error("%s: corrupted precompiled header", pch_path);
+
+  if (rec->kind == TK_STR) {
+    tok->ty = array_of(ty, rec->array_len, tok);
+    tok->str = read_string(rec->str);
+  } else {
+    tok->ty = ty;
+  }
+}
+
+// Links tokens [idx, idx + len) into a list.
+static Token *link_tokens(uint32_t idx, uint32_t len) {
+  if (len == 0)
+    return NULL;
+  if (idx + len > header->ntokens || tokens[idx + len - 1].kind != TK_EOF)
+    error("%s: corrupted precompiled header", pch_path);
+
+  for (uint32_t i = idx; i < idx + len - 1; i++)
+    tokens[i].next = &tokens[i + 1];
+  return &tokens[idx];
+}
+
+static bool is_dynamic_macro(char *name) {
+  return !strcmp(name, "__DATE__") || !strcmp(name, "__TIME__");
+}
+
+static void read_macros(void) {
+  HashMap *macros = get_macros();
+  PchMacro *recs = (PchMacro *)(base + header->macros);
+  uint32_t *params = (uint32_t *)(base + header->params);
+
+  // The saved macro table replaces the current one. Builtin macros are
+  // implemented by handler functions, and __DATE__ and __TIME__ are
+  // defined when the compilation starts, so we keep the current ones if
+  // the header didn't #undef them.
+  HashMap builtins = {};
+  for (int i = 0; hashmap_next(macros, &i);) {
+    HashEntry *ent = &macros->buckets[i - 1];
+    Macro *m = ent->val;
+    if (m->handler || is_dynamic_macro(m->name))
+      hashmap_put2(&builtins, ent->key, ent->keylen, ent->val);
+  }
+  *macros = (HashMap){};
+
+  for (uint32_t i = 0; i < header->nmacros; i++) {
+    PchMacro *rec = &recs[i];
+    char *name = read_string(rec->name);
+
+    if (rec->is_builtin || is_dynamic_macro(name)) {
+      Macro *m = hashmap_get(&builtins, name);
+      if (m)
+        hashmap_put(macros, name, m);
+      continue;
+    }
+
+    Macro *m = calloc(1, sizeof(Macro));
+    m->name = name;
+    m->is_objlike = rec->is_objlike;
+    m->va_args_name = read_string(rec->va_args_name);
+    m->body = link_tokens(rec->body, rec->nbody);
+
+    MacroParam head = {};
+    MacroParam *cur = &head;
+    for (uint32_t j = 0; j < rec->nparams; j++) {
+      cur = cur->next = calloc(1, sizeof(MacroParam));
+      cur->name = read_string(params[rec->params + j]);
+    }
+    m->params = head.next;
+
+    hashmap_put(macros, name, m);
+  }
+}
+
+Token *read_pch(char *path, char *flags) {
+  pch_path = path;
+
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    error("%s: %s", path, strerror(errno));
+
+  size_t size;
+  FILE *out = open_memstream(&base, &size);
+  for (;;) {
+    char buf[4096];
+    int n = fread(buf, 1, sizeof(buf), fp);
+    if (n == 0)
+      break;
+    fwrite(buf, 1, n, out);
+  }
+  fclose(fp);
+  fclose(out);
+
+  if (size < sizeof(PchHeader))
+    error("%s: not a precompiled header", path);
+
+  header = (PchHeader *)base;
+  if (memcmp(header->magic, PCH_MAGIC, sizeof(header->magic)))
+    error("%s: not a precompiled header", path);
+  if (header->version != PCH_VERSION || header->size != size ||
+      strcmp(read_string(header->stamp), PCH_STAMP))
+    error("%s: precompiled header was built by a different compiler", path);
+  if (header->mem_model != mem_model)
+    error("%s: precompiled header was built for a different memory model", path);
+  if (strcmp(read_string(header->flags), flags))
+    error("%s: precompiled header was built with different options: %s",
+          path, read_string(header->flags));
+
+  PchFile *file_recs = (PchFile *)(base + header->files);
+  files = calloc(header->nfiles, sizeof(File *));
+  for (uint32_t i = 0; i < header->nfiles; i++)
+    files[i] = load_file(&file_recs[i]);
+
+  PchToken *tok_recs = (PchToken *)(base + header->tokens);
+  tokens = calloc(header->ntokens, sizeof(Token));
+  for (uint32_t i = 0; i < header->ntokens; i++)
+    load_token(&tokens[i], &tok_recs[i]);
+
+  read_macros();
+
+  uint32_t *once = (uint32_t *)(base + header->once);
+  for (uint32_t i = 0; i < header->nonce; i++)
+    hashmap_put(get_pragma_once(), read_string(once[i]), (void *)1);
+
+  uint32_t *guards = (uint32_t *)(base + header->guards);
+  for (uint32_t i = 0; i < header->nguards; i++)
+    hashmap_put(get_include_guards(), read_string(guards[i * 2]),
+                read_string(guards[i * 2 + 1]));
+
+  set_pch_header(read_string(header->header),
+                 read_string(header->header_guard), header->header_once);
+
+  return link_tokens(header->body, header->nbody);
+}
@@ -0,0 +1,541 @@
+// This file implements a peephole optimizer for function bodies.
+//
+// The code generator writes the body of a function into a buffer.
+// The buffer is decoded into a list of instructions, labels and
+// directives, which is rewritten until no rule below applies and then
+// printed. Every rule keeps what is left on the evaluation stack and
+// what is stored to memory the same, so the rules can be applied in
+// any order.
+
+#include "chibicc.h"
+
+typedef enum {
+  IN_INSN,
+  IN_LABEL,
+  IN_DIRECTIVE,   // .local, .location and so on
+  IN_DELETED,
+} InsnKind;
+
+typedef struct {
+  InsnKind kind;
+  char *op;        // Opcode or label name
+  char *operand;   // NULL if the instruction has no operand
+  char *line;      // Text of a directive
+} Insn;
+
+typedef struct {
+  char *ty;        // CIL type name
+  char *name;      // NULL if the local is referred by its index
+  Insn *decl;
+  int refs;
+  int pairs;       // Number of `stloc X; ldloc X` pairs
+} Local;
+
+typedef struct {
+  Insn *insns;
+  int len;
+  HashMap labels;
+
+  Local *locals;
+  int nlocals;
+  HashMap local_names;
+} Body;
+
+//
+// Decoding and printing
+//
+
+static Insn *new_insn(Body *body) {
+  body->insns = realloc(body->insns, sizeof(Insn) * (body->len + 1));
+  Insn *in = &body->insns[body->len++];
+  *in = (Insn){};
+  return in;
+}
+
+static void add_local(Body *body, Insn *in) {
+  // .local <type> [<name>]
+  char *ty = strdup(in->line + strlen("  .local "));
+  char *name = strchr(ty, ' ');
+  if (name)
+    *name++ = '\0';
+
+  body->locals = realloc(body->locals, sizeof(Local) * (body->nlocals + 1));
+  body->locals[body->nlocals++] = (Local){ty, name, in};
+}
+
+static void decode(Body *body, char *p) {
+  while (*p) {
+    char *end = strchr(p, '\n');
+    char *next = end ? end + 1 : p + strlen(p);
+    if (end)
+      *end = '\0';
+    else
+      end = next;
+
+    Insn *in = new_insn(body);
+    if (p[0] == ' ' && p[1] == ' ' && p[2] != '.') {
+      in->kind = IN_INSN;
+      in->op = p + 2;
+      char *sp = strchr(in->op, ' ');
+      if (sp) {
+        *sp = '\0';
+        in->operand = sp + 1;
+      }
+    } else if (end > p && end[-1] == ':' && p[0] != ' ') {
+      in->kind = IN_LABEL;
+      end[-1] = '\0';
+      in->op = p;
+    } else {
+      in->kind = IN_DIRECTIVE;
+      in->line = p;
+    }
+    p = next;
+  }
+
+  // Labels and locals are looked up by their indices, since the list
+  // is not resized anymore.
+  for (int i = 0; i < body->len; i++) {
+    Insn *in = &body->insns[i];
+    if (in->kind == IN_LABEL)
+      hashmap_put(&body->labels, in->op, in);
+    else if (in->kind == IN_DIRECTIVE && !strncmp(in->line, "  .local ", 9))
+      add_local(body, in);
+  }
+  for (int i = 0; i < body->nlocals; i++)
+    if (body->locals[i].name)
+      hashmap_put(&body->local_names, body->locals[i].name, &body->locals[i]);
+}
+
+static int count_insns(Body *body) {
+  int n = 0;
+  for (int i = 0; i < body->len; i++)
+    if (body->insns[i].kind == IN_INSN)
+      n++;
+  return n;
+}
+
+static void print_body(Body *body, FILE *out) {
+  for (int i = 0; i < body->len; i++) {
+    Insn *in = &body->insns[i];
+    switch (in->kind) {
+    case IN_INSN:
+      if (in->operand)
+        fprintf(out, "  %s %s\n", in->op, in->operand);
+      else
+        fprintf(out, "  %s\n", in->op);
+      break;
+    case IN_LABEL:
+      fprintf(out, "%s:\n", in->op);
+      break;
+    case IN_DIRECTIVE:
+      fprintf(out, "%s\n", in->line);
+      break;
+    }
+  }
+}
+
+//
+// Helpers for the rules
+//
+
+// Returns the instruction following the i-th one, or -1 if a label
+// or the end of the body comes first.
+static int next_insn(Body *body, int i) {
+  if (i < 0)
+    return -1;
+  for (int j = i + 1; j < body->len; j++) {
+    switch (body->insns[j].kind) {
+    case IN_INSN:
+      return j;
+    case IN_LABEL:
+      return -1;
+    }
+  }
+  return -1;
+}
+
+// Returns the first instruction executed after jumping to a label.
+static Insn *label_target(Body *body, char *label) {
+  Insn *in = hashmap_get(&body->labels, label);
+  if (!in)
+    return NULL;
+  for (in++; in < body->insns + body->len; in++)
+    if (in->kind == IN_INSN)
+      return in;
+  return NULL;
+}
+
+static bool is_op(Body *body, int i, char *op) {
+  return i >= 0 && !strcmp(body->insns[i].op, op);
+}
+
+static void delete(Body *body, int i) {
+  body->insns[i].kind = IN_DELETED;
+}
+
+static bool get_ldc_i4(Insn *in, int *val) {
+  if (!strcmp(in->op, "ldc.i4.m1")) {
+    *val = -1;
+    return true;
+  }
+  if (!strncmp(in->op, "ldc.i4.", 7) && in->op[7] >= '0' && in->op[7] <= '8' && !in->op[8]) {
+    *val = in->op[7] - '0';
+    return true;
+  }
+  if (!strcmp(in->op, "ldc.i4.s") || !strcmp(in->op, "ldc.i4")) {
+    *val = strtol(in->operand, NULL, 0);
+    return true;
+  }
+  return false;
+}
+
+// Matches a zero of the type of an integer comparand, `ldc.i4.0`
+// optionally converted to native int, or to int64 if `allow_int64`.
+// Returns the last instruction of the zero.
+static int match_zero(Body *body, int i, bool allow_int64) {
+  if (allow_int64 && is_op(body, i, "ldc.i8") && !strcmp(body->insns[i].operand, "0"))
+    return i;
+  if (!is_op(body, i, "ldc.i4.0"))
+    return -1;
+
+  int j = next_insn(body, i);
+  if (is_op(body, j, "conv.i") || is_op(body, j, "conv.u"))
+    return j;
+  if (allow_int64 && (is_op(body, j, "conv.i8") || is_op(body, j, "conv.u8")))
+    return j;
+  return i;
+}
+
+// The short forms are not retargeted, since the distance to a new
+// target may not fit in them.
+static bool is_branch(char *op, bool allow_short) {
+  static char *ops[] = {
+    "br", "brtrue", "brfalse", "beq", "bne.un", "blt", "blt.un",
+    "ble", "ble.un", "bgt", "bgt.un", "bge", "bge.un",
+  };
+  int len = strlen(op);
+  if (allow_short && len > 2 && !strcmp(op + len - 2, ".s"))
+    len -= 2;
+  for (int i = 0; i < sizeof(ops) / sizeof(*ops); i++)
+    if (strlen(ops[i]) == len && !strncmp(op, ops[i], len))
+      return true;
+  return false;
+}
+
+static Local *find_local(Body *body, char *operand) {
+  if (isdigit(*operand)) {
+    int idx = atoi(operand);
+    return idx < body->nlocals ? &body->locals[idx] : NULL;
+  }
+  return hashmap_get(&body->local_names, operand);
+}
+
+// Whether a value is left unchanged by storing it to a local
+// of the type and loading it again.
+static bool is_lossless_local(Local *var) {
+  return !strcmp(var->ty, "int32") || !strcmp(var->ty, "uint32") ||
+         !strcmp(var->ty, "int64") || !strcmp(var->ty, "uint64");
+}
+
+//
+// Rules
+//
+
+// `dup; pop` does nothing.
+static bool rewrite_dup_pop(Body *body, int i) {
+  int j = next_insn(body, i);
+  if (!is_op(body, i, "dup") || !is_op(body, j, "pop"))
+    return false;
+  delete(body, i);
+  delete(body, j);
+  return true;
+}
+
+// `x == 0 == 0` is `x != 0`, that is `(unsigned)x > 0`:
+//   ldc.i4.0; [conv;] ceq; ldc.i4.0; ceq -> ldc.i4.0; [conv;] cgt.un
+// The comparand is an integer, since the zero is not converted to
+// a floating point number.
+static bool rewrite_double_not(Body *body, int i) {
+  int j = match_zero(body, i, true);
+  int k = next_insn(body, j);
+  int l = next_insn(body, k);
+  int m = next_insn(body, l);
+  if (j < 0 || !is_op(body, k, "ceq") || !is_op(body, l, "ldc.i4.0") || !is_op(body, m, "ceq"))
+    return false;
+
+  body->insns[k].op = "cgt.un";
+  delete(body, l);
+  delete(body, m);
+  return true;
+}
+
+// A comparison with zero followed by a conditional branch is the
+// branch itself for an int32 or a native int:
+//   ldc.i4.0; [conv.i;] ceq; brtrue L -> brfalse L
+//   ldc.i4.0; [conv.i;] cgt.un; brtrue L -> brtrue L
+static bool rewrite_cmp_branch(Body *body, int i) {
+  int j = match_zero(body, i, false);
+  int k = next_insn(body, j);
+  int l = next_insn(body, k);
+  if (j < 0 || l < 0)
+    return false;
+
+  Insn *cmp = &body->insns[k];
+  Insn *br = &body->insns[l];
+  bool is_true = !strcmp(br->op, "brtrue");
+  if (!is_true && strcmp(br->op, "brfalse"))
+    return false;
+
+  if (!strcmp(cmp->op, "ceq"))
+    br->op = is_true ? "brfalse" : "brtrue";
+  else if (strcmp(cmp->op, "cgt.un"))
+    return false;
+
+  for (int n = i; n <= k; n++)
+    if (body->insns[n].kind == IN_INSN)
+      delete(body, n);
+  return true;
+}
+
+// A small constant converted to int64 is loaded as is.
+//   ldc.i4 N; conv.i8 -> ldc.i8 N
+static bool rewrite_ldc_conv(Body *body, int i) {
+  int val;
+  if (!get_ldc_i4(&body->insns[i], &val))
+    return false;
+
+  int j = next_insn(body, i);
+  int64_t val8;
+  if (is_op(body, j, "conv.i8"))
+    val8 = val;
+  else if (is_op(body, j, "conv.u8"))
+    val8 = (uint32_t)val;
+  else
+    return false;
+
+  body->insns[i].op = "ldc.i8";
+  body->insns[i].operand = format("%ld", val8);
+  delete(body, j);
+  return true;
+}
+
+// A jump to a jump is made to its final target, a jump to `ret` is
+// `ret`, and a jump to the next instruction is removed.
+static bool rewrite_branch(Body *body, int i) {
+  Insn *in = &body->insns[i];
+  if (!is_branch(in->op, false))
+    return false;
+
+  // A chain of jumps which is too long or a loop is left as is.
+  char *label = in->operand;
+  for (int hops = 0; hops < 8; hops++) {
+    Insn *target = label_target(body, label);
+    if (!target || strcmp(target->op, "br"))
+      break;
+    label = target->operand;
+  }
+  if (strcmp(label, in->operand)) {
+    Insn *target = label_target(body, label);
+    if (!target || strcmp(target->op, "br")) {
+      in->operand = label;
+      return true;
+    }
+  }
+
+  if (strcmp(in->op, "br"))
+    return false;
+
+  Insn *target = label_target(body, in->operand);
+  if (target && !strcmp(target->op, "ret")) {
+    in->op = "ret";
+    in->operand = NULL;
+    return true;
+  }
+
+  for (int j = i + 1; j < body->len; j++) {
+    Insn *next = &body->insns[j];
+    if (next->kind == IN_INSN)
+      break;
+    if (next->kind == IN_LABEL && !strcmp(next->op, in->operand)) {
+      delete(body, i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// A conditional branch over an unconditional one is inverted:
+//   brtrue L1; br L2; L1: -> brfalse L2; L1:
+// Only the branches whose inverse is the same for integers and floats
+// are inverted, since the type of the operands is not known here.
+static bool rewrite_branch_over(Body *body, int i) {
+  static char *inverses[][2] = {
+    {"brtrue", "brfalse"}, {"brfalse", "brtrue"}, {"beq", "bne.un"}, {"bne.un", "beq"},
+  };
+
+  Insn *in = &body->insns[i];
+  char *inverse = NULL;
+  for (int n = 0; n < sizeof(inverses) / sizeof(*inverses); n++)
+    if (!strcmp(in->op, inverses[n][0]))
+      inverse = inverses[n][1];
+
+  int j = next_insn(body, i);
+  if (!inverse || !is_op(body, j, "br"))
+    return false;
+
+  for (int k = j + 1; k < body->len; k++) {
+    Insn *next = &body->insns[k];
+    if (next->kind == IN_INSN)
+      break;
+    if (next->kind == IN_LABEL && !strcmp(next->op, in->operand)) {
+      in->op = inverse;
+      in->operand = body->insns[j].operand;
+      delete(body, j);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Instructions after an unconditional jump are dead until a label.
+static bool rewrite_dead_code(Body *body, int i) {
+  if (!is_op(body, i, "br") && !is_op(body, i, "ret"))
+    return false;
+
+  bool changed = false;
+  for (int j = next_insn(body, i); j >= 0; j = next_insn(body, j)) {
+    delete(body, j);
+    changed = true;
+  }
+  return changed;
+}
+
+// Labels no jump refers to are removed, so that the code after them
+// can be found dead.
+static bool rewrite_labels(Body *body) {
+  HashMap refs = {};
+  for (int i = 0; i < body->len; i++) {
+    Insn *in = &body->insns[i];
+    if (in->kind != IN_INSN || !in->operand)
+      continue;
+    if (is_branch(in->op, true)) {
+      hashmap_put(&refs, in->operand, (void *)1);
+    } else if (!strcmp(in->op, "switch")) {
+      for (char *p = in->operand; *p;) {
+        char *comma = strchr(p, ',');
+        int len = comma ? comma - p : strlen(p);
+        hashmap_put2(&refs, p, len, (void *)1);
+        p += comma ? len + 1 : len;
+      }
+    }
+  }
+
+  bool changed = false;
+  for (int i = 0; i < body->len; i++) {
+    Insn *in = &body->insns[i];
+    if (in->kind == IN_LABEL && !hashmap_get(&refs, in->op)) {
+      delete(body, i);
+      changed = true;
+    }
+  }
+  free(refs.buckets);
+  return changed;
+}
+
+static bool is_temp(Local *var) {
+  return var->name && !strncmp(var->name, "__", 2);
+}
+
+// Rewrites `stloc X; ldloc X` pairs.
+// If a temporary made by the code generator is used only by such
+// pairs, it just converts a managed pointer to an unmanaged one or
+// does nothing. The pairs are replaced with `conv.u` or removed, and
+// so is the temporary. The other locals are referred by their indices
+// and stay. For them, the value is kept on the stack with `dup` if
+// storing it to the local does not narrow it.
+static bool rewrite_locals(Body *body) {
+  for (int i = 0; i < body->nlocals; i++)
+    body->locals[i].refs = body->locals[i].pairs = 0;
+
+  for (int i = 0; i < body->len; i++) {
+    Insn *in = &body->insns[i];
+    if (in->kind != IN_INSN || !in->operand ||
+        (strncmp(in->op, "ldloc", 5) && strncmp(in->op, "stloc", 5)))
+      continue;
+
+    Local *var = find_local(body, in->operand);
+    if (!var)
+      continue;
+    var->refs++;
+
+    int j = next_insn(body, i);
+    if (!strcmp(in->op, "stloc") && is_op(body, j, "ldloc") &&
+        !strcmp(body->insns[j].operand, in->operand))
+      var->pairs++;
+  }
+
+  bool changed = false;
+  for (int i = 0; i < body->nlocals; i++) {
+    Local *var = &body->locals[i];
+    if (is_temp(var) && var->refs == var->pairs * 2 && var->decl->kind == IN_DIRECTIVE) {
+      var->decl->kind = IN_DELETED;
+      changed = true;
+    }
+  }
+
+  for (int i = 0; i < body->len; i++) {
+    Insn *in = &body->insns[i];
+    if (in->kind != IN_INSN || strcmp(in->op, "stloc"))
+      continue;
+    int j = next_insn(body, i);
+    if (!is_op(body, j, "ldloc") || strcmp(body->insns[j].operand, in->operand))
+      continue;
+
+    Local *var = find_local(body, in->operand);
+    if (!var)
+      continue;
+
+    if (var->decl->kind == IN_DELETED) {
+      if (var->ty[strlen(var->ty) - 1] == '*') {
+        in->op = "conv.u";
+        in->operand = NULL;
+      } else {
+        delete(body, i);
+      }
+      delete(body, j);
+      changed = true;
+    } else if (is_lossless_local(var)) {
+      body->insns[j].op = "stloc";
+      in->op = "dup";
+      in->operand = NULL;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void optimize_function_body(char *buf, FILE *out, int *insns_before, int *insns_after) {
+  Body body = {};
+  decode(&body, buf);
+  *insns_before = count_insns(&body);
+
+  for (bool changed = true; changed;) {
+    changed = rewrite_locals(&body) | rewrite_labels(&body);
+    for (int i = 0; i < body.len; i++)
+      if (body.insns[i].kind == IN_INSN)
+        changed |= rewrite_dup_pop(&body, i) || rewrite_double_not(&body, i) ||
+                   rewrite_cmp_branch(&body, i) || rewrite_ldc_conv(&body, i) ||
+                   rewrite_branch(&body, i) || rewrite_branch_over(&body, i) ||
+                   rewrite_dead_code(&body, i);
+  }
+
+  *insns_after = count_insns(&body);
+  print_body(&body, out);
+
+  free(body.insns);
+  free(body.labels.buckets);
+  for (int i = 0; i < body.nlocals; i++)
+    free(body.locals[i].ty);
+  free(body.locals);
+  free(body.local_names.buckets);
+}
@@ -24,11 +24,7 @@
 
 #include "chibicc.h"
 
-typedef struct MacroParam MacroParam;
-struct MacroParam {
-  MacroParam *next;
-  char *name;
-};
+extern char *realpath(const char *name, char *resolved);
 
 typedef struct MacroArg MacroArg;
 struct MacroArg {
@@ -38,18 +34,6 @@ struct MacroArg {
   Token *tok;
 };
 
-typedef Token *macro_handler_fn(Token *);
-
-typedef struct Macro Macro;
-struct Macro {
-  char *name;
-  bool is_objlike; // Object-like or function-like
-  MacroParam *params;
-  char *va_args_name;
-  Token *body;
-  macro_handler_fn *handler;
-};
-
 // `#if` can be nested, so we use a stack to manage nested `#if`s.
 typedef struct CondIncl CondIncl;
 struct CondIncl {
@@ -68,10 +52,16 @@ struct Hideset {
 static HashMap macros;
 static CondIncl *cond_incl;
 static HashMap pragma_once;
+static HashMap include_guards;
 static int include_next_idx;
 
-static Token *preprocess2(Token *tok);
+static Token *preprocess2(Token *tok, bool emit);
 static Macro *find_macro(Token *tok);
+static uint64_t stats_clock(void);
+static void record_expansion(Macro *m, Token *tok, int ntokens, uint64_t start);
+static void record_include(char *path, Token *tok);
+static void begin_include_span(char *path, Token *filename_tok);
+static void end_include_spans(Token *tok);
 
 static bool is_hash(Token *tok) {
   return tok->at_bol && equal(tok, "#");
@@ -280,7 +270,7 @@ static Token *read_const_expr(Token **rest, Token *tok) {
 static long eval_const_expr(Token **rest, Token *tok) {
   Token *start = tok;
   Token *expr = read_const_expr(rest, tok->next);
-  expr = preprocess2(expr);
+  expr = preprocess2(expr, false);
 
   if (expr->kind == TK_EOF)
     error_tok(start, "no expression");
@@ -289,7 +279,14 @@ static long eval_const_expr(Token **rest, Token *tok) {
   // we replace remaining non-macro identifiers with "0" before
   // evaluating a constant expression. For example, `#if foo` is
   // equivalent to `#if 0` if foo is not defined.
+  //
+  // String literals and statement expressions are not integer constant
+  // expressions. The parser would also define a global or a scope for
+  // them, which must not happen on the -fpipeline preprocessor thread.
   for (Token *t = expr; t->kind != TK_EOF; t = t->next) {
+    if (t->kind == TK_STR || equal(t, "{") || equal(t, "}"))
+      error_tok(t, "token is not valid in preprocessor expressions");
+
     if (t->kind == TK_IDENT) {
       Token *next = t->next;
       *t = *new_num_token(0, t);
@@ -606,7 +603,7 @@ static Token *subst(Token *tok, MacroArg *args) {
     // Handle a macro token. Macro arguments are completely macro-expanded
     // before they are substituted into a macro body.
     if (arg) {
-      Token *t = preprocess2(arg->tok);
+      Token *t = preprocess2(arg->tok, false);
       t->at_bol = tok->at_bol;
       t->has_space = tok->has_space;
       for (; t->kind != TK_EOF; t = t->next)
@@ -635,10 +632,13 @@ static bool expand_macro(Token **rest, Token *tok) {
   if (!m)
     return false;
 
+  uint64_t start = stats_clock();
+
   // Built-in dynamic macro application such as __LINE__
   if (m->handler) {
     *rest = m->handler(tok);
     (*rest)->next = tok->next;
+    record_expansion(m, tok, 1, start);
     return true;
   }
 
@@ -646,11 +646,13 @@ static bool expand_macro(Token **rest, Token *tok) {
   if (m->is_objlike) {
     Hideset *hs = hideset_union(tok->hideset, new_hideset(m->name));
     Token *body = add_hideset(m->body, hs);
-    for (Token *t = body; t->kind != TK_EOF; t = t->next)
+    int ntokens = 0;
+    for (Token *t = body; t->kind != TK_EOF; t = t->next, ntokens++)
       t->origin = tok;
     *rest = append(body, tok->next);
     (*rest)->at_bol = tok->at_bol;
     (*rest)->has_space = tok->has_space;
+    record_expansion(m, tok, ntokens, start);
     return true;
   }
 
@@ -674,11 +676,13 @@ static bool expand_macro(Token **rest, Token *tok) {
 
   Token *body = subst(m->body, args);
   body = add_hideset(body, hs);
-  for (Token *t = body; t->kind != TK_EOF; t = t->next)
+  int ntokens = 0;
+  for (Token *t = body; t->kind != TK_EOF; t = t->next, ntokens++)
     t->origin = macro_token;
   *rest = append(body, tok->next);
   (*rest)->at_bol = macro_token->at_bol;
   (*rest)->has_space = macro_token->has_space;
+  record_expansion(m, macro_token, ntokens, start);
   return true;
 }
 
@@ -746,7 +750,7 @@ static char *read_include_filename(Token **rest, Token *tok, bool *is_dquote) {
   // In this case FOO must be macro-expanded to either
   // a single string token or a sequence of "<" ... ">".
   if (tok->kind == TK_IDENT) {
-    Token *tok2 = preprocess2(copy_line(rest, tok));
+    Token *tok2 = preprocess2(copy_line(rest, tok), false);
     return read_include_filename(&tok2, tok2, is_dquote);
   }
 
@@ -759,7 +763,7 @@ static char *read_include_filename(Token **rest, Token *tok, bool *is_dquote) {
 //   #define FOO_H
 //   ...
 //   #endif
-static char *detect_include_guard(Token *tok) {
+char *detect_include_guard(Token *tok) {
   // Detect the first two lines.
   if (!is_hash(tok) || !equal(tok->next, "ifndef"))
     return NULL;
@@ -792,7 +796,39 @@ static char *detect_include_guard(Token *tok) {
   return NULL;
 }
 
+// The header a precompiled header was built from. Its tokens are
+// already in the output, so including it again behaves as if it had
+// been included before: it is skipped if it has "#pragma once" or an
+// include guard.
+static char *pch_header;
+static char *pch_header_guard;
+static bool pch_header_once;
+
+void set_pch_header(char *fullpath, char *guard, bool once) {
+  pch_header = fullpath;
+  pch_header_guard = guard;
+  pch_header_once = once;
+}
+
+static bool is_pch_header(char *path) {
+  char *fullpath = realpath(path, NULL);
+  bool ret = fullpath && !strcmp(fullpath, pch_header);
+  free(fullpath);
+  return ret;
+}
+
 static Token *include_file(Token *tok, char *path, Token *filename_tok) {
+  record_include(path, NULL);
+
+  // The precompiled header may be included under any spelling of
+  // its path, so compare the resolved paths.
+  if (pch_header && !hashmap_get(&include_guards, path) && is_pch_header(path)) {
+    if (pch_header_once)
+      hashmap_put(&pragma_once, path, (void *)1);
+    else if (pch_header_guard)
+      hashmap_put(&include_guards, path, pch_header_guard);
+  }
+
   // Check for "#pragma once"
   if (hashmap_get(&pragma_once, path))
     return tok;
@@ -800,14 +836,18 @@ static Token *include_file(Token *tok, char *path, Token *filename_tok) {
   // If we read the same file before, and if the file was guarded
   // by the usual #ifndef ... #endif pattern, we may be able to
   // skip the file without opening it.
-  static HashMap include_guards;
   char *guard_name = hashmap_get(&include_guards, path);
   if (guard_name && hashmap_get(&macros, guard_name))
     return tok;
 
+  begin_include_span(path, filename_tok);
+
+  trace_begin("Tokenize", path);
   Token *tok2 = tokenize_file(path);
   if (!tok2)
     error_tok(filename_tok, "%s: cannot open file: %s", path, strerror(errno));
+  trace_end(NULL);
+  record_include(path, tok2);
 
   guard_name = detect_include_guard(tok2);
   if (guard_name)
@@ -834,13 +874,18 @@ static void read_line_marker(Token **rest, Token *tok) {
   start->file->display_name = tok->str;
 }
 
+static void pipeline_emit(Token *tok);
+
 // Visit all tokens in `tok` while evaluating preprocessing
-// macros and directives.
-static Token *preprocess2(Token *tok) {
+// macros and directives. If `emit` is true, each output token is
+// also handed to the pipeline as soon as it is produced.
+static Token *preprocess2(Token *tok, bool emit) {
   Token head = {};
   Token *cur = &head;
 
   while (tok->kind != TK_EOF) {
+    end_include_spans(tok);
+
     // If it is a macro, expand it.
     if (expand_macro(&tok, tok))
       continue;
@@ -851,6 +896,8 @@ static Token *preprocess2(Token *tok) {
       tok->filename = tok->file->display_name;
       cur = cur->next = tok;
       tok = tok->next;
+      if (emit)
+        pipeline_emit(cur);
       continue;
     }
 
@@ -986,10 +1033,27 @@ static Token *preprocess2(Token *tok) {
     error_tok(tok, "invalid preprocessor directive");
   }
 
+  end_include_spans(tok);
   cur->next = tok;
+  if (emit)
+    pipeline_emit(tok);
   return head.next;
 }
 
+// The following accessors expose the preprocessor state so that
+// it can be saved to and restored from a precompiled header.
+HashMap *get_macros(void) {
+  return &macros;
+}
+
+HashMap *get_pragma_once(void) {
+  return &pragma_once;
+}
+
+HashMap *get_include_guards(void) {
+  return &include_guards;
+}
+
 void define_macro(char *name, char *buf) {
   Token *tok = tokenize(new_file("<built-in>", 1, buf));
   add_macro(name, true, tok);
@@ -1214,76 +1278,64 @@ static StringKind getStringKind(Token *tok) {
   unreachable();
 }
 
-// Concatenate adjacent string literals into a single string literal
-// as per the C spec.
-static void join_adjacent_string_literals(Token *tok) {
-  // First pass: If regular string literals are adjacent to wide
-  // string literals, regular string literals are converted to a wide
-  // type before concatenation. In this pass, we do the conversion.
-  for (Token *tok1 = tok; tok1->kind != TK_EOF;) {
-    if (tok1->kind != TK_STR || tok1->next->kind != TK_STR) {
-      tok1 = tok1->next;
-      continue;
-    }
-
-    StringKind kind = getStringKind(tok1);
-    Type *basety = tok1->ty->base;
-
-    for (Token *t = tok1->next; t->kind == TK_STR; t = t->next) {
-      StringKind k = getStringKind(t);
-      if (kind == STR_NONE) {
-        kind = k;
-        basety = t->ty->base;
-      } else if (k != STR_NONE && kind != k) {
-        error_tok(t, "unsupported non-standard concatenation of string literals");
-      }
+// Concatenate a run of adjacent string literals starting at `tok1`
+// into a single string literal as per the C spec.
+static void join_string_literals(Token *tok1) {
+  // If regular string literals are adjacent to wide string literals,
+  // regular string literals are converted to a wide type before
+  // concatenation.
+  StringKind kind = getStringKind(tok1);
+  Type *basety = tok1->ty->base;
+
+  for (Token *t = tok1->next; t->kind == TK_STR; t = t->next) {
+    StringKind k = getStringKind(t);
+    if (kind == STR_NONE) {
+      kind = k;
+      basety = t->ty->base;
+    } else if (k != STR_NONE && kind != k) {
+      error_tok(t, "unsupported non-standard concatenation of string literals");
     }
-
-    if (basety->kind == TY_SHORT || basety->kind == TY_INT)
-      for (Token *t = tok1; t->kind == TK_STR; t = t->next)
-        if (t->ty->base->kind == TY_CHAR)
-          *t = *tokenize_string_literal(t, basety);
-
-    while (tok1->kind == TK_STR)
-      tok1 = tok1->next;
   }
 
-  // Second pass: concatenate adjacent string literals.
-  for (Token *tok1 = tok; tok1->kind != TK_EOF;) {
-    if (tok1->kind != TK_STR || tok1->next->kind != TK_STR) {
-      tok1 = tok1->next;
-      continue;
-    }
+  if (basety->kind == TY_SHORT || basety->kind == TY_INT)
+    for (Token *t = tok1; t->kind == TK_STR; t = t->next)
+      if (t->ty->base->kind == TY_CHAR)
+        *t = *tokenize_string_literal(t, basety);
 
-    Token *tok2 = tok1->next;
-    while (tok2->kind == TK_STR)
-      tok2 = tok2->next;
+  // Concatenate the string literals.
+  Token *tok2 = tok1->next;
+  while (tok2->kind == TK_STR)
+    tok2 = tok2->next;
 
-    int len = tok1->ty->array_len;
-    for (Token *t = tok1->next; t != tok2; t = t->next)
-      len = len + t->ty->array_len - 1;
+  int len = tok1->ty->array_len;
+  for (Token *t = tok1->next; t != tok2; t = t->next)
+    len = len + t->ty->array_len - 1;
 
-    char *buf = calloc(get_by_integer(tok1->ty->base->size), len);
+  char *buf = calloc(get_by_integer(tok1->ty->base->size), len);
 
-    int i = 0;
-    for (Token *t = tok1; t != tok2; t = t->next) {
-      int len = t->ty->array_len;
-      int size = get_by_integer(t->ty->base->size);
-      memcpy(buf + i, t->str, len * size);
-      i = i + (len - 1) * size;
-    }
-
-    *tok1 = *copy_token(tok1);
-    tok1->ty = array_of(tok1->ty->base, len, tok1);
-    tok1->str = buf;
-    tok1->next = tok2;
-    tok1 = tok2;
+  int i = 0;
+  for (Token *t = tok1; t != tok2; t = t->next) {
+    int len = t->ty->array_len;
+    int size = get_by_integer(t->ty->base->size);
+    memcpy(buf + i, t->str, len * size);
+    i = i + (len - 1) * size;
   }
+
+  *tok1 = *copy_token(tok1);
+  tok1->ty = array_of(tok1->ty->base, len, tok1);
+  tok1->str = buf;
+  tok1->next = tok2;
+}
+
+static void join_adjacent_string_literals(Token *tok) {
+  for (Token *tok1 = tok; tok1->kind != TK_EOF; tok1 = tok1->next)
+    if (tok1->kind == TK_STR && tok1->next->kind == TK_STR)
+      join_string_literals(tok1);
 }
 
 // Entry point function of the preprocessor.
 Token *preprocess(Token *tok) {
-  tok = preprocess2(tok);
+  tok = preprocess2(tok, false);
   if (cond_incl)
     error_tok(cond_incl->tok, "unterminated conditional directive");
   convert_pp_tokens(tok);
@@ -1293,3 +1345,398 @@ Token *preprocess(Token *tok) {
     t->line_no += t->line_delta;
   return tok;
 }
+
+//
+// Pipelined preprocessing
+//
+// With -fpipeline, the preprocessor runs on its own thread and the
+// parser consumes its output while it is still being produced. Output
+// tokens are converted and their string literals are joined as soon
+// as they are final. The end of each top-level declaration is then
+// published to the parser through a bounded single-producer
+// single-consumer ring. Either side sleeps on a condition variable
+// while the ring is full or empty.
+//
+// A token published as the end of a declaration is followed by a
+// token whose contents are final, so the parser may look at the first
+// token of the next declaration before waiting for the rest of it.
+//
+// The preprocessor doesn't publish a declaration while more than
+// PIPELINE_MAX_TOKENS tokens are waiting for the parser, unless the
+// parser has caught up. So it runs ahead of the parser by at most that
+// many tokens plus one declaration.
+
+#define PIPELINE_SIZE 1024
+#define PIPELINE_MAX_TOKENS 65536
+
+static Token *pipeline[PIPELINE_SIZE];
+static unsigned pipeline_pos[PIPELINE_SIZE];
+static unsigned pipeline_head;
+static unsigned pipeline_tail;
+static unsigned pipeline_consumed;
+static pthread_mutex_t pipeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipeline_not_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pipeline_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_t pipeline_thread;
+static bool is_pipelined;
+
+// Producer state
+static unsigned emitted;
+static Token *first_token;
+static Token *str_run;
+static Token *pending_end;
+static Token *prev_token;
+static int depth;
+static bool in_initializer;
+static bool in_function_body;
+
+// Consumer state
+static Token *ready_end;
+
+static bool pipeline_is_full(void) {
+  unsigned len = pipeline_tail - pipeline_head;
+  if (len == 0)
+    return false;
+  return len == PIPELINE_SIZE || emitted - pipeline_consumed > PIPELINE_MAX_TOKENS;
+}
+
+static void pipeline_publish(Token *tok) {
+  pthread_mutex_lock(&pipeline_lock);
+  while (pipeline_is_full())
+    pthread_cond_wait(&pipeline_not_full, &pipeline_lock);
+
+  pipeline[pipeline_tail % PIPELINE_SIZE] = tok;
+  pipeline_pos[pipeline_tail % PIPELINE_SIZE] = emitted;
+  pipeline_tail++;
+  pthread_cond_signal(&pipeline_not_empty);
+  pthread_mutex_unlock(&pipeline_lock);
+}
+
+static Token *pipeline_consume(void) {
+  pthread_mutex_lock(&pipeline_lock);
+  while (pipeline_tail == pipeline_head)
+    pthread_cond_wait(&pipeline_not_empty, &pipeline_lock);
+
+  Token *tok = pipeline[pipeline_head % PIPELINE_SIZE];
+  pipeline_consumed = pipeline_pos[pipeline_head % PIPELINE_SIZE];
+  pipeline_head++;
+  pthread_cond_signal(&pipeline_not_full);
+  pthread_mutex_unlock(&pipeline_lock);
+  return tok;
+}
+
+// Looks for the end of a top-level declaration, which is either a
+// ";" or the "}" of a function body. A "{" following a ")" starts a
+// function body unless it is a compound literal in an initializer.
+static void pipeline_scan(Token *tok) {
+  if (pending_end) {
+    pipeline_publish(pending_end);
+    pending_end = NULL;
+    in_initializer = false;
+  }
+
+  if (equal(tok, "(") || equal(tok, "[") || equal(tok, "{")) {
+    if (depth == 0 && equal(tok, "{"))
+      in_function_body = !in_initializer && prev_token && equal(prev_token, ")");
+    depth++;
+  } else if (equal(tok, ")") || equal(tok, "]") || equal(tok, "}")) {
+    if (depth > 0)
+      depth--;
+    if (depth == 0 && equal(tok, "}") && in_function_body)
+      pending_end = tok;
+  } else if (depth == 0 && equal(tok, ";")) {
+    pending_end = tok;
+  } else if (depth == 0 && equal(tok, "=")) {
+    in_initializer = true;
+  }
+
+  prev_token = tok;
+}
+
+// Called for each token appended to the top-level output.
+static void pipeline_emit(Token *tok) {
+  if (!first_token)
+    first_token = tok;
+  emitted++;
+
+  if (tok->kind != TK_EOF) {
+    convert_pp_token(tok);
+    tok->line_no += tok->line_delta;
+  }
+
+  // A string literal is not final until we know that it isn't
+  // followed by another one.
+  if (tok->kind == TK_STR) {
+    if (!str_run)
+      str_run = tok;
+    return;
+  }
+
+  if (str_run) {
+    if (str_run->next->kind == TK_STR)
+      join_string_literals(str_run);
+    pipeline_scan(str_run);
+    str_run = NULL;
+  }
+
+  if (tok->kind != TK_EOF) {
+    pipeline_scan(tok);
+    return;
+  }
+
+  if (cond_incl)
+    error_tok(cond_incl->tok, "unterminated conditional directive");
+  tok->line_no += tok->line_delta;
+
+  if (pending_end)
+    pipeline_publish(pending_end);
+  pipeline_publish(tok);
+}
+
+static void *preprocess_thread(void *arg) {
+  trace_begin("Preprocess", NULL);
+  preprocess2(arg, true);
+  trace_end(NULL);
+  return NULL;
+}
+
+// Starts preprocessing on a new thread and returns the first output
+// token. The parser must call wait_for_tokens() before it parses each
+// top-level declaration.
+Token *preprocess_pipelined(Token *tok) {
+  is_pipelined = true;
+  if (pthread_create(&pipeline_thread, NULL, preprocess_thread, tok))
+    error("cannot create a thread: %s", strerror(errno));
+
+  ready_end = pipeline_consume();
+  if (ready_end->kind == TK_EOF) {
+    pthread_join(pipeline_thread, NULL);
+    is_pipelined = false;
+  }
+  return first_token;
+}
+
+// Blocks until the declaration starting at `tok` has been preprocessed.
+void wait_for_tokens(Token *tok) {
+  if (!is_pipelined)
+    return;
+
+  while (tok == ready_end->next) {
+    ready_end = pipeline_consume();
+
+    if (ready_end->kind == TK_EOF) {
+      pthread_join(pipeline_thread, NULL);
+      is_pipelined = false;
+      return;
+    }
+  }
+}
+
+//
+// Macro expansion statistics
+//
+// With -fmacro-stats, we record the number of expansions, the number
+// of produced tokens, the time spent and the maximum nesting depth
+// for each macro, as well as the number of tokens and inclusions for
+// each header. The time of an expansion includes the time spent in
+// expanding its arguments, so times of nested macros are counted
+// more than once.
+
+typedef struct {
+  char *name;
+  long count;
+  long tokens;
+  uint64_t nsec;
+  int max_depth;
+} MacroStat;
+
+typedef struct {
+  char *path;
+  long includes;
+  long tokenized;
+  long tokens;
+} HeaderStat;
+
+static bool is_stats_enabled;
+static HashMap macro_stats;
+static HashMap header_stats;
+
+void enable_macro_stats(void) {
+  is_stats_enabled = true;
+}
+
+static uint64_t stats_clock(void) {
+  if (!is_stats_enabled)
+    return 0;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void record_expansion(Macro *m, Token *tok, int ntokens, uint64_t start) {
+  if (!is_stats_enabled)
+    return;
+
+  MacroStat *st = hashmap_get(&macro_stats, m->name);
+  if (!st) {
+    st = calloc(1, sizeof(MacroStat));
+    st->name = m->name;
+    hashmap_put(&macro_stats, m->name, st);
+  }
+
+  // A macro token that came from another macro's expansion
+  // has the origin.
+  int depth = 1;
+  for (Token *t = tok->origin; t; t = t->origin)
+    depth++;
+
+  st->count++;
+  st->tokens += ntokens;
+  st->nsec += stats_clock() - start;
+  st->max_depth = MAX(st->max_depth, depth);
+}
+
+// Records an #include of `path`. `tok` is the token list of the
+// header if it was actually read.
+static void record_include(char *path, Token *tok) {
+  if (!is_stats_enabled)
+    return;
+
+  HeaderStat *st = hashmap_get(&header_stats, path);
+  if (!st) {
+    st = calloc(1, sizeof(HeaderStat));
+    st->path = path;
+    hashmap_put(&header_stats, path, st);
+  }
+
+  if (!tok) {
+    st->includes++;
+    return;
+  }
+
+  st->tokenized++;
+  for (; tok->kind != TK_EOF; tok = tok->next)
+    st->tokens++;
+}
+
+static int compare_macro_stats(const void *a, const void *b) {
+  MacroStat *x = *(MacroStat **)a;
+  MacroStat *y = *(MacroStat **)b;
+  if (x->nsec != y->nsec)
+    return (x->nsec < y->nsec) ? 1 : -1;
+  return strcmp(x->name, y->name);
+}
+
+static int compare_header_stats(const void *a, const void *b) {
+  HeaderStat *x = *(HeaderStat **)a;
+  HeaderStat *y = *(HeaderStat **)b;
+  if (x->tokens != y->tokens)
+    return (x->tokens < y->tokens) ? 1 : -1;
+  return strcmp(x->path, y->path);
+}
+
+// Returns the values of a given map sorted with `cmp`.
+static void **sorted_values(HashMap *map, int *len,
+                            int (*cmp)(const void *, const void *)) {
+  void **arr = calloc(map->used + 1, sizeof(void *));
+  *len = 0;
+  int i = 0;
+  for (HashEntry *ent = hashmap_next(map, &i); ent; ent = hashmap_next(map, &i))
+    arr[(*len)++] = ent->val;
+  qsort(arr, *len, sizeof(void *), cmp);
+  return arr;
+}
+
+void print_macro_stats(FILE *out, bool json) {
+  int nmacros, nheaders;
+  MacroStat **macros = (MacroStat **)sorted_values(&macro_stats, &nmacros, compare_macro_stats);
+  HeaderStat **headers = (HeaderStat **)sorted_values(&header_stats, &nheaders, compare_header_stats);
+
+  if (json) {
+    fprintf(out, "{\"macros\":[");
+    for (int i = 0; i < nmacros; i++) {
+      MacroStat *st = macros[i];
+      fprintf(out, "%s\n{\"name\":", i ? "," : "");
+      print_json_string(out, st->name);
+      fprintf(out, ",\"count\":%ld,\"tokens\":%ld,\"time_us\":%.3f,\"max_depth\":%d}",
+              st->count, st->tokens, st->nsec / 1000.0, st->max_depth);
+    }
+    fprintf(out, "],\n\"headers\":[");
+    for (int i = 0; i < nheaders; i++) {
+      HeaderStat *st = headers[i];
+      fprintf(out, "%s\n{\"path\":", i ? "," : "");
+      print_json_string(out, st->path);
+      fprintf(out, ",\"includes\":%ld,\"tokenized\":%ld,\"tokens\":%ld}",
+              st->includes, st->tokenized, st->tokens);
+    }
+    fprintf(out, "]}\n");
+    return;
+  }
+
+  fprintf(out, "%10s %10s %12s %6s  %s\n", "expansions", "tokens", "time (ms)", "depth", "macro");
+  for (int i = 0; i < nmacros; i++) {
+    MacroStat *st = macros[i];
+    fprintf(out, "%10ld %10ld %12.3f %6d  %s\n",
+            st->count, st->tokens, st->nsec / 1000000.0, st->max_depth, st->name);
+  }
+
+  fprintf(out, "\n%10s %10s %10s  %s\n", "includes", "tokenized", "tokens", "header");
+  for (int i = 0; i < nheaders; i++) {
+    HeaderStat *st = headers[i];
+    fprintf(out, "%10ld %10ld %10ld  %s\n", st->includes, st->tokenized, st->tokens, st->path);
+  }
+}
+
+//
+// -ftime-trace spans of included files
+//
+// The tokens of an included file are spliced into the input and
+// then preprocessed by the main loop of preprocess2(), so the span
+// of a header ends when the loop reaches a token of a file that
+// included it, or a token of the main source file.
+
+typedef struct IncludeSpan IncludeSpan;
+struct IncludeSpan {
+  IncludeSpan *up;
+  File *parent;
+};
+
+static IncludeSpan *include_spans;
+
+static void begin_include_span(char *path, Token *filename_tok) {
+  if (!is_tracing)
+    return;
+
+  IncludeSpan *span = calloc(1, sizeof(IncludeSpan));
+  span->up = include_spans;
+  span->parent = filename_tok->file;
+  include_spans = span;
+  trace_begin("Include", path);
+}
+
+static void end_include_spans(Token *tok) {
+  // Tokens made by macro expansion belong to the file of the macro
+  // definition, so they do not tell where we are.
+  if (!include_spans || tok->origin)
+    return;
+
+  IncludeSpan *span = include_spans;
+  if (strcmp(tok->file->name, base_file)) {
+    while (span && span->parent != tok->file)
+      span = span->up;
+    if (!span)
+      return;
+  } else {
+    while (span->up)
+      span = span->up;
+  }
+
+  for (;;) {
+    IncludeSpan *top = include_spans;
+    include_spans = top->up;
+    trace_end(NULL);
+    if (top == span)
+      return;
+  }
+}
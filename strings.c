@@ -29,3 +29,17 @@ char *format(char *fmt, ...) {
   fclose(out);
   return buf;
 }
+
+// Writes a given string as a JSON string literal.
+void print_json_string(FILE *out, char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(out, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(out, "\\u%04x", *s);
+    else
+      fputc(*s, out);
+  }
+  fputc('"', out);
+}
@@ -4,11 +4,56 @@
  * This is a block comment.
  */
 
+// Loops whose iteration cost is dominated by the loop control.
+int sum_for(int *a, int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++)
+    s += a[i];
+  return s;
+}
+
+int sum_while(int *a, int n) {
+  int s = 0, i = 0;
+  while (i < n && a[i] != 100) {
+    if (a[i] < 0) {
+      i++;
+      continue;
+    }
+    s += a[i++];
+  }
+  return s;
+}
+
+int sum_do(int *a, int n) {
+  int s = 0, i = 0;
+  do {
+    if (a[i] == 0)
+      continue;
+    s += a[i];
+  } while (++i < n);
+  return s;
+}
+
+int loops(int rounds) {
+  int a[100];
+  for (int i = 0; i < 100; i++)
+    a[i] = i % 7 - 1;
+  int total = 0;
+  for (int r = 0; r < rounds; r++)
+    total += sum_for(a, 100) + sum_while(a, 100) + sum_do(a, 100);
+  return total == rounds * (195 + 210 + 195);
+}
+
 int main() {
   ASSERT(3, ({ int x; if (0) x=2; else x=3; x; }));
   ASSERT(3, ({ int x; if (1-1) x=2; else x=3; x; }));
   ASSERT(2, ({ int x; if (1) x=2; else x=3; x; }));
   ASSERT(2, ({ int x; if (2-1) x=2; else x=3; x; }));
+  ASSERT(2, ({ int x; if (1) x=2; else x=3; x; }));
+  ASSERT(3, ({ int x=3; if (0) x=2; x; }));
+  ASSERT(5, ({ int i=0; while (1) { if (++i > 4) break; } i; }));
+  ASSERT(1, ({ int x=0; do { x++; } while (0); x; }));
+  ASSERT(1, ({ int x=0; do { x++; if (x < 2) continue; x=5; } while (0); x; }));
 
   ASSERT(55, ({ int i=0; int j=0; for (i=0; i<=10; i=i+1) j=i+j; j; }));
 
@@ -95,6 +140,12 @@ int main() {
   //ASSERT(2, ({ static void *p[]={&&v52,&&v52,&&v53}; int i=0; goto *p[1]; v51:i++; v52:i++; v53:i++; i; }));
   //ASSERT(1, ({ static void *p[]={&&v62,&&v62,&&v63}; int i=0; goto *p[2]; v61:i++; v62:i++; v63:i++; i; }));
 
+  ASSERT(195, ({ int a[100]; for (int i = 0; i < 100; i++) a[i] = i % 7 - 1; sum_for(a, 100); }));
+  ASSERT(0, ({ int a[1]; sum_for(a, 0); }));
+  ASSERT(0, ({ int a[1] = {-1}; sum_while(a, 1); }));
+  ASSERT(1, loops(1));
+  ASSERT(1, loops(10));
+
   printf("OK\n");
   return 0;
 }
@@ -321,4 +321,238 @@ echo foo > $tmp/dir/isystem-option-test
 echo "#include <isystem-option-test>" | $chibicc -isystem $tmp/dir -E -xc - | grep -q foo
 check -isystem
 
+# -x c-header, -include-pch
+echo '#pragma once' > $tmp/pch.h
+echo '#define PCH_FOO 42' >> $tmp/pch.h
+echo 'int pch_bar(void);' >> $tmp/pch.h
+$chibicc -x c-header -o $tmp/pch.pch $tmp/pch.h
+[ -f $tmp/pch.pch ]
+check '-x c-header'
+echo '#include "pch.h"' > $tmp/pch.c
+echo 'int main() { return pch_bar() + PCH_FOO; }' >> $tmp/pch.c
+$chibicc -include-pch $tmp/pch.pch -S -o- $tmp/pch.c | grep -q 'ldc.i4.s 42'
+check -include-pch
+$chibicc -DPCH_BAZ -include-pch $tmp/pch.pch -S -o- $tmp/pch.c 2>&1 | grep -q 'different options'
+check -include-pch
+$chibicc -march=m32 -include-pch $tmp/pch.pch -S -o- $tmp/pch.c 2>&1 | grep -q 'different memory model'
+check -include-pch
+$chibicc -I$tmp -include-pch $tmp/pch.pch -S -o- $tmp/pch.c 2>&1 | grep -q 'different options'
+check -include-pch
+$chibicc -include $tmp/pch.h -include-pch $tmp/pch.pch -S -o- $tmp/pch.c 2>&1 | grep -q 'different options'
+check -include-pch
+echo 'static char *pch_time = __TIME__;' > $tmp/pch-time.h
+$chibicc -x c-header -o $tmp/pch-time.pch $tmp/pch-time.h
+echo 'char *f(void) { return __TIME__; }' > $tmp/pch-time.c
+sleep 1
+[ $($chibicc -include-pch $tmp/pch-time.pch -E $tmp/pch-time.c | grep -o '"[0-9:]*"' | sort -u | wc -l) = 2 ]
+check -include-pch
+printf '#ifndef PCH_GUARD_H\n#define PCH_GUARD_H\nint pch_guarded;\n#endif\n' > $tmp/pch-guard.h
+$chibicc -x c-header -o $tmp/pch-guard.pch $tmp/./pch-guard.h
+echo '#include "pch-guard.h"' > $tmp/pch-guard.c
+[ $($chibicc -include-pch $tmp/pch-guard.pch -E $tmp/pch-guard.c | grep -c pch_guarded) = 1 ]
+check -include-pch
+
+# -fpipeline (test/macro.c expands __TIME__, so its output may differ)
+for i in test/*.c; do
+  $chibicc -Iinclude -Itest -S -o $tmp/serial.s $i
+  $chibicc -fpipeline -Iinclude -Itest -S -o $tmp/pipelined.s $i
+  cmp -s $tmp/serial.s $tmp/pipelined.s || [ $i = test/macro.c ] || exit 1
+done
+check -fpipeline
+seq 20000 | awk '{ print "int v" $1 " = " $1 ";" }' > $tmp/decls.c
+$chibicc -S -o $tmp/serial.s $tmp/decls.c
+$chibicc -fpipeline -S -o $tmp/pipelined.s $tmp/decls.c
+cmp -s $tmp/serial.s $tmp/pipelined.s
+check -fpipeline
+printf 'int a;\n#if "x"[0]\n#endif\n' > $tmp/pipeline-if.c
+$chibicc -fpipeline -S -o $tmp/pipelined.s $tmp/pipeline-if.c 2>&1 | grep -q 'not valid in preprocessor expressions'
+check -fpipeline
+
+# String literals and braces are not valid in #if in any mode
+$chibicc -S -o $tmp/serial.s $tmp/pipeline-if.c 2>&1 | grep -q 'not valid in preprocessor expressions'
+check '#if'
+printf '#if ({ 1; })\n#endif\n' > $tmp/if-brace.c
+$chibicc -S -o $tmp/serial.s $tmp/if-brace.c 2>&1 | grep -q 'not valid in preprocessor expressions'
+check '#if'
+
+# -fmacro-stats
+echo '#define ONE 1' > $tmp/mstats.h
+echo '#define TWO (ONE + ONE)' >> $tmp/mstats.h
+echo '#include "mstats.h"' > $tmp/mstats.c
+echo '#include "mstats.h"' >> $tmp/mstats.c
+echo 'int x = TWO;' >> $tmp/mstats.c
+$chibicc -fmacro-stats -S -o /dev/null $tmp/mstats.c 2> $tmp/mstats.txt
+grep -Eq '^ +1 +5 .* 1  TWO$' $tmp/mstats.txt
+check -fmacro-stats
+grep -Eq '^ +2 +2 .* 2  ONE$' $tmp/mstats.txt
+check -fmacro-stats
+grep -Eq '^ +2 +2 +[0-9]+  .*/mstats.h$' $tmp/mstats.txt
+check -fmacro-stats
+$chibicc -fmacro-stats=json -S -o /dev/null $tmp/mstats.c 2>&1 | grep -q '{"name":"ONE","count":2,"tokens":2,'
+check -fmacro-stats=json
+
+# -ftime-trace
+echo 'int trace1;' > $tmp/trace2.h
+echo '#include "trace2.h"' > $tmp/trace1.h
+echo '#include "trace1.h"' > $tmp/trace.c
+echo 'struct S { int x; }; int trace_main() { return 0; }' >> $tmp/trace.c
+$chibicc -ftime-trace=$tmp/trace.json -S -o /dev/null $tmp/trace.c
+grep -q '"name":"Include","args":{"detail":"[^"]*/trace2.h"}' $tmp/trace.json
+check -ftime-trace
+grep -q '"name":"ParseFunction","args":{"detail":"trace_main"}' $tmp/trace.json
+check -ftime-trace
+grep -q '"name":"CodegenFunction","args":{"detail":"trace_main"}' $tmp/trace.json
+check -ftime-trace
+grep -q '"name":"StructLayout","args":{"detail":"S"}' $tmp/trace.json
+check -ftime-trace
+rm -f $tmp/trace.json
+(cd $tmp; $OLDPWD/$chibicc -ftime-trace -S -o /dev/null trace.c)
+[ -f $tmp/trace.json ] && [ ! -f $tmp/null.json ]
+check -ftime-trace
+rm -f $tmp/md2.d
+(cd $tmp; $OLDPWD/$chibicc -ftime-trace -MD -S -o - md2.c > /dev/null)
+[ -f $tmp/md2.json ] && [ -f $tmp/md2.d ] && [ ! -f $tmp/-.json ]
+check -ftime-trace
+
+# -fmem-report
+$chibicc -fmem-report -S -o /dev/null test/arith.c -Iinclude -Itest 2>&1 | grep -Eq '^AST: [1-9][0-9]* nodes, [0-9]+ bytes per node'
+check -fmem-report
+$chibicc -fmem-report -S -o /dev/null test/arith.c -Iinclude -Itest 2>&1 | grep -Eq '^Types: [1-9][0-9]* types'
+check -fmem-report
+
+# Functions with many labels and cases
+{
+  echo 'int labels(int x) {'
+  awk 'BEGIN { for (i = 0; i < 50000; i++) print "  if (x == " i ") goto L" i ";" }'
+  awk 'BEGIN { for (i = 0; i < 50000; i++) print "L" i ": x++;" }'
+  echo '  return x;'
+  echo '}'
+  echo 'int cases(int x) {'
+  echo '  switch (x) {'
+  awk 'BEGIN { for (i = 0; i < 50000; i++) print "  case " i ": return " i ";" }'
+  echo '  }'
+  echo '  return -1;'
+  echo '}'
+} > $tmp/labels.c
+timeout 30 $chibicc -S -o $tmp/labels.s $tmp/labels.c
+check 'many labels and cases'
+
+# Duplicate case values
+echo 'int f(int x) { switch (x) { case 1: case 0 ... 2: return 0; } return 1; }' > $tmp/dupcase.c
+$chibicc -S -o /dev/null $tmp/dupcase.c 2>&1 | grep -q 'duplicate case value'
+check 'duplicate case value'
+
+# Dense switches are dispatched by a jump table
+echo 'int f(int x) { switch (x) { case 0: return 3; case 1: return 1; case 2: return 4; case 3: return 1; case 4: return 5; } return 0; }' > $tmp/jumptable.c
+$chibicc -S -o $tmp/jumptable.s $tmp/jumptable.c
+grep -q '^  switch ' $tmp/jumptable.s
+check 'jump tables'
+$chibicc -fno-jump-tables -S -o $tmp/jumptable.s $tmp/jumptable.c
+! grep -q '^  switch ' $tmp/jumptable.s && grep -q '^  beq ' $tmp/jumptable.s
+check -fno-jump-tables
+
+# Unreachable static functions, variables, string literals and types
+echo 'struct S { int a; }; static int g1 = 1; static int g2 = 2; static char *s1 = "unused";
+static int f1(void) { return g1; } static int f2(void) { return f1(); } static int f3(struct S *p) { return p->a; }
+int foo() { return f1(); }' > $tmp/dce.c
+$chibicc -o- -S $tmp/dce.c > $tmp/dce.s
+grep -q "int32() f1" $tmp/dce.s && grep -q "int32\* g1" $tmp/dce.s
+check 'dead code elimination'
+! grep -Eq "int32\(\) f2|f3|g2|s1|unused|structure.* S" $tmp/dce.s
+check 'dead code elimination'
+
+# Functions are generated in parallel, but the output is deterministic
+awk 'BEGIN { for (i = 0; i < 500; i++) print "int f" i "(int x) { if (x) return x * " i "; while (x--) ; return 0; }" }' > $tmp/funcs.c
+$chibicc -fcodegen-threads=1 -S -o $tmp/funcs1.s $tmp/funcs.c
+$chibicc -fcodegen-threads=4 -S -o $tmp/funcs2.s $tmp/funcs.c
+cmp -s $tmp/funcs1.s $tmp/funcs2.s
+check 'parallel codegen'
+for i in test/control.c test/struct.c test/function.c; do
+  $chibicc -fcodegen-threads=1 -Iinclude -Itest -S -o $tmp/funcs1.s $i
+  $chibicc -fcodegen-threads=4 -Iinclude -Itest -S -o $tmp/funcs2.s $i
+  cmp -s $tmp/funcs1.s $tmp/funcs2.s || exit 1
+done
+check 'parallel codegen'
+$chibicc -fcodegen-threads=0 -S -o $tmp/funcs1.s $tmp/funcs.c 2>&1 | grep -q 'invalid number of codegen threads'
+check -fcodegen-threads
+
+# Layout of large structs with pointer-sized members under AnyCPU
+awk 'BEGIN { print "struct S {"; for (i = 0; i < 2000; i++) print (i % 3 ? "  void *p" : "  char c") i ";"; print "};"; print "int f(struct S *s) { return s->c1998 + sizeof(struct S); }" }' > $tmp/bigstruct.c
+timeout 10 $chibicc -march=any -S -o $tmp/bigstruct.s $tmp/bigstruct.c && [ $(wc -c < $tmp/bigstruct.s) -lt 1000000 ]
+check 'large struct layout'
+
+# Member offsets depending on the pointer size are folded per bitness
+echo 'struct S { char c; void *p; int x; }; int f(struct S *s) { return s->x; }' > $tmp/anyoffset.c
+$chibicc -march=any -S -o $tmp/anyoffset.s $tmp/anyoffset.c
+grep -q 'sizeof nuint' $tmp/anyoffset.s && ! grep -q 'ldsfld' $tmp/anyoffset.s
+check 'AnyCPU member offset'
+
+# Members of fixed-layout structs are accessed as fields
+echo 'struct P { int x; long y; }; struct Q { char c; struct P p; }; long f(struct Q *q) { q->p.x = 1; return q->p.y; }' > $tmp/field.c
+$chibicc -march=m64 -S -o $tmp/field.s $tmp/field.c
+grep -q 'ldflda _Q_\$[0-9]*\.p' $tmp/field.s && grep -q 'stfld _P_\$[0-9]*\.x' $tmp/field.s &&
+  grep -q 'ldfld _P_\$[0-9]*\.y' $tmp/field.s && ! grep -q '^  add' $tmp/field.s
+check 'struct field access'
+
+# Bitfields are still accessed by their offsets
+echo 'struct B { int a : 3; int b; }; int f(struct B *s) { return s->b; }' > $tmp/bitfield.c
+$chibicc -march=m64 -S -o $tmp/bitfield.s $tmp/bitfield.c
+! grep -q 'ldfld' $tmp/bitfield.s
+check 'bitfield struct member offset'
+
+# Temporary locals are reused
+awk 'BEGIN { print "struct S { int x, y; } g(void); int f(void) { int r = 0;"; for (i = 0; i < 100; i++) print "  r = r + g().y;"; print "  return r; }" }' > $tmp/temps.c
+$chibicc -S -fmem-report -o $tmp/temps.s $tmp/temps.c 2>&1 | grep -q 'Locals: f: 101 before reuse, 2 after' &&
+  [ $(grep -c '\.local' $tmp/temps.s) = 2 ]
+check 'temporary local reuse'
+
+# Function bodies go through the peephole optimizer
+echo 'long f(long *p, int x) { long a[4] = {0}; if (x) return a[x & 3] + 1; return 0; }' > $tmp/peephole.c
+$chibicc -march=m64 -S -fmem-report -o $tmp/peephole.s $tmp/peephole.c 2>&1 | grep -q 'Instructions: f: [0-9]* before peephole' &&
+  ! grep -q 'ceq\|__ptr\|br _L_return\|conv.i8' $tmp/peephole.s
+check 'peephole optimizer'
+
+# Conditions are lowered to branches
+echo 'int f(int a, int b) { while (a < b && !(b == 3 || b <= a)) a++; return a; }' > $tmp/condbr.c
+$chibicc -march=m64 -S -o $tmp/condbr.s $tmp/condbr.c
+! grep -q 'ceq\|clt\|cgt' $tmp/condbr.s && grep -q '^  bge ' $tmp/condbr.s &&
+  grep -q '^  beq ' $tmp/condbr.s && grep -q '^  ble ' $tmp/condbr.s
+check 'branch conditions'
+
+# Constant conditions select a branch at compile time
+echo 'int f(int x) { if (1) x = 2; else x = 3; return x; }' > $tmp/condk1.c
+$chibicc -march=m64 -S -o $tmp/condk1.s $tmp/condk1.c
+grep -q 'ldc.i4.2' $tmp/condk1.s && ! grep -q 'ldc.i4.3' $tmp/condk1.s
+check 'constant true condition'
+echo 'int f(int x) { do { x++; } while (0); return x; }' > $tmp/condk2.c
+$chibicc -march=m64 -S -o $tmp/condk2.s $tmp/condk2.c
+! grep -q '^  br' $tmp/condk2.s
+check 'constant false condition'
+echo 'int f(int n) { int i = 0; while (1) { if (++i > n) break; } return i; }' > $tmp/condk3.c
+$chibicc -march=m64 -S -o $tmp/condk3.s $tmp/condk3.c
+grep -q '^  b[a-z.]* _L_begin' $tmp/condk3.s
+check 'constant loop condition'
+
+# Increments and compound assignments update variables in place
+echo 'int f(int *p, int n) { int s = 0; for (int i = 0; i < n; i++) { s += p[i]; p[i] <<= 1; } return s; }' > $tmp/inc.c
+$chibicc -march=m64 -S -o $tmp/inc.s $tmp/inc.c
+[ $(grep -c '\.local' $tmp/inc.s) = 2 ] && ! grep -q 'ldloca' $tmp/inc.s
+check 'in-place compound assignment'
+
+# Loops test their condition at the bottom
+echo 'int f(int *a, int n) { int s = 0; for (int i = 0; i < n; i++) { if (a[i] < 0) break; s += a[i]; } return s; }' > $tmp/loop.c
+$chibicc -march=m64 -S -o $tmp/loop.s $tmp/loop.c
+[ $(grep -c '^  b' $tmp/loop.s) = 3 ] && grep -q '^  bge ' $tmp/loop.s && grep -q '^  blt _L_begin' $tmp/loop.s
+check 'loop rotation'
+
+$chibicc -march=m64 -fno-loop-rotate -S -o $tmp/loop.s $tmp/loop.c
+grep -q '^  br _L_begin' $tmp/loop.s && ! grep -q '^  blt _L_begin' $tmp/loop.s
+check -fno-loop-rotate
+
+# Sparse global initializers are assigned instead of copied from an image
+echo 'char buf[1 << 16] = {1, [1000] = 2};' > $tmp/sparse.c
+$chibicc -march=m64 -S -o $tmp/sparse.s $tmp/sparse.c
+! grep -q '_const_' $tmp/sparse.s && [ $(grep -c 'stind.i1' $tmp/sparse.s) = 2 ]
+check 'sparse global initializer'
+
 echo OK
@@ -38,6 +38,15 @@ typedef struct { char a, b[]; } T65;
 T65 g65 = {'f','o','o',0};
 T65 g66 = {'f','o','o','b','a','r',0};
 
+int g70[300] = {[0 ... 99]=1, [150]=2, 3};
+struct { int a; int *b; char *c; short d:5; short e:7; double f; } g71 = {1, g70+150, "abc", -3, 40, 2.5};
+union { char a[3]; int b; } g72 = {{1, 2, 3}};
+char g73[4096] = {1, [4000]=2};
+struct { int a[100]; short b:5; } g74 = {{[99]=7}, -2};
+struct { int a; union { struct { long b; double c; }; char *d; }; int e; } g75 = {1, .c=2.5, 3};
+
+int ret3(void) { return 3; }
+
 int main() {
   ASSERT(1, ({ int x[3]={1,2,3}; x[0]; }));
   ASSERT(2, ({ int x[3]={1,2,3}; x[1]; }));
@@ -250,6 +259,8 @@ int main() {
 
   ASSERT(0x00ff, ({ union { unsigned short a; char b[2]; } x={.b[0]=0xff}; x.a; }));
   ASSERT(0xff00, ({ union { unsigned short a; char b[2]; } x={.b[1]=0xff}; x.a; }));
+  ASSERT(7, ({ struct { int a; union { int b; char c; }; } x={1, .b=7}; x.b; }));
+  ASSERT(9, ({ struct { int a; union { struct { int b, c; }; long d; }; } x={1, .c=9}; x.c; }));
 
   ASSERT(0x00120000, g50.a);
   ASSERT(0, g51[0].a);
@@ -262,6 +273,44 @@ int main() {
   ASSERT(16, ({ char x[]={[2 ... 10]='a', [7]='b', [15 ... 15]='c', [3 ... 5]='d'}; sizeof(x); }));
   ASSERT(0, ({ char x[]={[2 ... 10]='a', [7]='b', [15 ... 15]='c', [3 ... 5]='d'}; memcmp(x, "\0\0adddabaaa\0\0\0\0c", 16); }));
 
+  ASSERT(7, ({ int y=7; int x[100]={1,2,3,4,[50]=5,6,y,8,9,[99]=10}; x[52]; }));
+  ASSERT(48, ({ int y=7; int x[100]={1,2,3,4,[50]=5,6,y,8,9,[99]=10}; x[0]+x[1]+x[2]+x[3]+x[4]+x[49]+x[50]+x[51]+x[53]+x[54]+x[55]+x[98]+x[99]; }));
+  ASSERT(0, ({ int y=7; int x[100]={1,2,3,4,[50]=5,6,y,8,9,[99]=10}; int s=0; for (int i=4; i<50; i++) s+=x[i]; for (int i=55; i<99; i++) s+=x[i]; s; }));
+  ASSERT(5, ({ long x[2][3]={{1,2,3},{4,5,6}}; x[1][1]; }));
+  ASSERT(-3, ({ short x[6]={-1,-2,-3,-4,[5]=-6}; x[2]; }));
+  ASSERT(0, ({ short x[6]={-1,-2,-3,-4,[5]=-6}; x[4]; }));
+  ASSERT(1, ({ _Bool x[5]={2,0,3,0,4}; x[0]; }));
+  ASSERT(3, ({ _Bool x[5]={2,0,3,0,4}; x[0]+x[1]+x[2]+x[3]+x[4]; }));
+  ASSERT(25, ({ double x[4]={0.5,1.5,2.5,3.5}; (int)(x[2]*10); }));
+  ASSERT(44, ({ unsigned char x[5]={300,1,2,3,4}; x[0]; }));
+  ASSERT(0, ({ char x[1000]="abc"; x[999]; }));
+  ASSERT('c', ({ char x[1000]="abc"; x[2]; }));
+  ASSERT(3, ({ struct { int a; int b[8]; } x={1,{2,3,4,5,6}}; x.b[1]; }));
+  ASSERT(0, ({ struct { int a; int b[8]; } x={1,{2,3,4,5,6}}; x.b[7]; }));
+
+  ASSERT(105, ({ int s=0; for (int i=0; i<300; i++) s+=g70[i]; s; }));
+  ASSERT(1, g71.a);
+  ASSERT(2, g71.b[0]);
+  ASSERT(3, g71.b[1]);
+  ASSERT('b', g71.c[1]);
+  ASSERT(-3, g71.d);
+  ASSERT(40, g71.e);
+  ASSERT(25, (int)(g71.f*10));
+  ASSERT(0x030201, g72.b);
+  ASSERT(7, ({ int x[3]={ret3()+4, 1, 2}; x[0]; }));
+  ASSERT(2, ({ unsigned x[]={ret3(), ({ 2; }), 5, 6}; x[1]; }));
+  ASSERT(6, ({ unsigned x[]={ret3(), ({ 2; }), 5, 6}; x[3]; }));
+  ASSERT(1, g73[0]);
+  ASSERT(0, g73[1]);
+  ASSERT(2, g73[4000]);
+  ASSERT(3, ({ int s=0; for (int i=0; i<4096; i++) s+=g73[i]; s; }));
+  ASSERT(0, g74.a[0]);
+  ASSERT(7, g74.a[99]);
+  ASSERT(-2, g74.b);
+  ASSERT(1, g75.a);
+  ASSERT(2, (int)g75.c);
+  ASSERT(3, g75.e);
+
   printf("OK\n");
   return 0;
 }
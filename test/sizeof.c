@@ -1,5 +1,14 @@
 #include "test.h"
 
+unsigned long scaled_size = sizeof(void *) * 4 * 8 / 8 + 2 + 3;
+unsigned long offset_size = (sizeof(void *) + 4) + 8;
+unsigned long mod_size = sizeof(void *) * 3 % 8;
+unsigned long aligned_size = (sizeof(void *) + 7) / 8 * 8;
+int is_not_4 = sizeof(void *) != 4;
+int one_ne_two = 1 != 2;
+int divided_size = (int)sizeof(void *) / 65536 / 65536;
+unsigned long halved_size = sizeof(void *) / 2 / 2;
+
 int main() {
   ASSERT(1, sizeof(char));
   ASSERT(2, sizeof(short));
@@ -105,6 +114,15 @@ int main() {
 
   ASSERT(1, sizeof(main));
 
+  ASSERT(getptrsize() * 4 + 5, scaled_size);
+  ASSERT(getptrsize() + 12, offset_size);
+  ASSERT(getptrsize() * 3 % 8, mod_size);
+  ASSERT(8, aligned_size);
+  ASSERT(getptrsize() != 4, is_not_4);
+  ASSERT(1, one_ne_two);
+  ASSERT(0, divided_size);
+  ASSERT(getptrsize() / 4, halved_size);
+
   printf("OK\n");
   return 0;
 }
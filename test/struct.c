@@ -58,6 +58,15 @@ int main() {
   ASSERT(1, ({ struct T { struct T *next; int x; } a; struct T b; b.x=1; a.next=&b; a.next->x; }));
   ASSERT(4, ({ typedef struct T T; struct T { int x; }; sizeof(T); }));
 
+  ASSERT(getptrsize() * 3 + 16, ({ struct { char c; void *p; int i; long l; void *q; char d; } x; (char *)&x.d - (char *)&x; }));
+  ASSERT(getptrsize() * 4 + 16, ({ struct { char c; void *p; int i; long l; void *q; char d; } x; sizeof(x); }));
+  ASSERT(getptrsize() * 2, ({ struct { void *p; char c; } x; sizeof(x); }));
+  ASSERT(getptrsize() * 2, ({ struct { struct { char c; void *p; } s; char d; } x; (char *)&x.d - (char *)&x; }));
+  ASSERT(getptrsize() * 3, ({ struct { struct { char c; void *p; } s; char d; } x; sizeof(x); }));
+  ASSERT(getptrsize(), ({ struct { char c; union { int i; void *p; } u; } x; _Alignof(x); }));
+  ASSERT(getptrsize() * 2, ({ struct { int *p; int a : 3, b : 5; } x; sizeof(x); }));
+  ASSERT(-2, ({ struct { int *p; int a : 3, b : 5; } x; x.a = 3; x.b = -2; x.b; }));
+
   printf("OK\n");
   return 0;
 }
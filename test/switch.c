@@ -0,0 +1,243 @@
+#include "test.h"
+
+int dense(int x) {
+  switch (x) {
+  case -2: return 10;
+  case -1: return 11;
+  case 0: return 12;
+  case 1: return 13;
+  case 3: return 14;
+  case 4: return 15;
+  default: return 99;
+  }
+}
+
+int sparse(int x) {
+  switch (x) {
+  case -100000: return 1;
+  case -7: return 2;
+  case 0: return 3;
+  case 13: return 4;
+  case 1000: return 5;
+  case 65536: return 6;
+  case 2147483647: return 7;
+  }
+  return 0;
+}
+
+int ranges(int x) {
+  switch (x) {
+  case 'a' ... 'z': return 1;
+  case 'A' ... 'Z': return 2;
+  case '0' ... '9': return 3;
+  case '_': return 4;
+  case 128 ... 2147483647: return 5;
+  case -2147483647 - 1 ... -1: return 6;
+  }
+  return 0;
+}
+
+int mixed(unsigned char c) {
+  switch (c) {
+  case 0: return 1;
+  case 1 ... 3: return 2;
+  case 4: return 3;
+  case 5: return 4;
+  case 6 ... 9: return 5;
+  case 255: return 6;
+  }
+  return 0;
+}
+
+int unsigned_int(unsigned x) {
+  switch (x) {
+  case 0: return 1;
+  case 1: return 2;
+  case 2: return 3;
+  case 3: return 4;
+  case 0x7fffffff: return 5;
+  case 0x80000000: return 6;
+  case 0xfffffffe: return 7;
+  case 0xffffffff: return 8;
+  }
+  return 0;
+}
+
+int wide(long x) {
+  switch (x) {
+  case 0: return 1;
+  case 1: return 2;
+  case 2: return 3;
+  case 3: return 4;
+  case 0x100000000: return 5;
+  case 0x100000001: return 6;
+  case -0x100000000: return 7;
+  case 0x7fffffffffffffff: return 8;
+  }
+  return 0;
+}
+
+int unsigned_wide(unsigned long x) {
+  switch (x) {
+  case 1: return 1;
+  case 2: return 2;
+  case 3: return 3;
+  case 4: return 4;
+  case 0x8000000000000000: return 5;
+  case -1: return 6;
+  }
+  return 0;
+}
+
+int native(intptr_t x) {
+  switch (x) {
+  case -3: return 1;
+  case -2: return 2;
+  case -1: return 3;
+  case 0: return 4;
+  case 100: return 5;
+  }
+  return 0;
+}
+
+int fallthrough(int x) {
+  int r = 0;
+  switch (x) {
+  case 0: r += 1;
+  case 1: r += 2;
+  case 2: r += 4;
+  case 3: r += 8; break;
+  case 4: r += 16;
+  default: r += 32;
+  }
+  return r;
+}
+
+// An interpreter loop whose dispatch is a switch with 200 cases.
+#define OP(n) case (n): acc = acc * 3 + (n); break;
+#define OP10(n) OP((n)*10+0) OP((n)*10+1) OP((n)*10+2) OP((n)*10+3) OP((n)*10+4) \
+  OP((n)*10+5) OP((n)*10+6) OP((n)*10+7) OP((n)*10+8) OP((n)*10+9)
+#define OP100(n) OP10((n)*10+0) OP10((n)*10+1) OP10((n)*10+2) OP10((n)*10+3) OP10((n)*10+4) \
+  OP10((n)*10+5) OP10((n)*10+6) OP10((n)*10+7) OP10((n)*10+8) OP10((n)*10+9)
+
+unsigned interpret(unsigned char *code, int len, int rounds) {
+  unsigned acc = 0;
+  for (int r = 0; r < rounds; r++) {
+    for (int pc = 0; pc < len; pc++) {
+      switch (code[pc]) {
+      OP100(0)
+      OP100(1)
+      default: acc = 0;
+      }
+    }
+  }
+  return acc;
+}
+
+unsigned interpret_expected(unsigned char *code, int len, int rounds) {
+  unsigned acc = 0;
+  for (int r = 0; r < rounds; r++)
+    for (int pc = 0; pc < len; pc++)
+      acc = code[pc] < 200 ? acc * 3 + code[pc] : 0;
+  return acc;
+}
+
+int interpreter(int rounds) {
+  unsigned char code[1000];
+  for (int i = 0; i < 1000; i++)
+    code[i] = (i * 7919) % 200;
+  return interpret(code, 1000, rounds) == interpret_expected(code, 1000, rounds);
+}
+
+int main() {
+  ASSERT(10, dense(-2));
+  ASSERT(11, dense(-1));
+  ASSERT(12, dense(0));
+  ASSERT(13, dense(1));
+  ASSERT(99, dense(2));
+  ASSERT(14, dense(3));
+  ASSERT(15, dense(4));
+  ASSERT(99, dense(5));
+  ASSERT(99, dense(-3));
+  ASSERT(99, dense(-2147483647 - 1));
+  ASSERT(99, dense(2147483647));
+
+  ASSERT(1, sparse(-100000));
+  ASSERT(2, sparse(-7));
+  ASSERT(3, sparse(0));
+  ASSERT(4, sparse(13));
+  ASSERT(5, sparse(1000));
+  ASSERT(6, sparse(65536));
+  ASSERT(7, sparse(2147483647));
+  ASSERT(0, sparse(1));
+  ASSERT(0, sparse(-8));
+  ASSERT(0, sparse(65535));
+
+  ASSERT(1, ranges('a'));
+  ASSERT(1, ranges('m'));
+  ASSERT(1, ranges('z'));
+  ASSERT(2, ranges('A'));
+  ASSERT(2, ranges('Z'));
+  ASSERT(3, ranges('5'));
+  ASSERT(4, ranges('_'));
+  ASSERT(0, ranges('{'));
+  ASSERT(0, ranges('@'));
+  ASSERT(5, ranges(128));
+  ASSERT(5, ranges(2147483647));
+  ASSERT(6, ranges(-1));
+  ASSERT(6, ranges(-2147483647 - 1));
+  ASSERT(0, ranges(127));
+
+  ASSERT(1, mixed(0));
+  ASSERT(2, mixed(2));
+  ASSERT(3, mixed(4));
+  ASSERT(4, mixed(5));
+  ASSERT(5, mixed(9));
+  ASSERT(0, mixed(10));
+  ASSERT(6, mixed(255));
+
+  ASSERT(1, unsigned_int(0));
+  ASSERT(4, unsigned_int(3));
+  ASSERT(0, unsigned_int(4));
+  ASSERT(5, unsigned_int(0x7fffffff));
+  ASSERT(6, unsigned_int(0x80000000));
+  ASSERT(7, unsigned_int(0xfffffffe));
+  ASSERT(8, unsigned_int(-1));
+  ASSERT(0, unsigned_int(0xfffffffd));
+
+  ASSERT(1, wide(0));
+  ASSERT(4, wide(3));
+  ASSERT(0, wide(4));
+  ASSERT(0, wide(-1));
+  ASSERT(5, wide(0x100000000));
+  ASSERT(6, wide(0x100000001));
+  ASSERT(7, wide(-0x100000000));
+  ASSERT(8, wide(0x7fffffffffffffff));
+  ASSERT(0, wide(0x100000002));
+
+  ASSERT(1, unsigned_wide(1));
+  ASSERT(4, unsigned_wide(4));
+  ASSERT(0, unsigned_wide(0));
+  ASSERT(0, unsigned_wide(0x100000002));
+  ASSERT(5, unsigned_wide(0x8000000000000000));
+  ASSERT(6, unsigned_wide(-1));
+
+  ASSERT(1, native(-3));
+  ASSERT(3, native(-1));
+  ASSERT(4, native(0));
+  ASSERT(5, native(100));
+  ASSERT(0, native(1));
+  ASSERT(0, native(-4));
+
+  ASSERT(15, fallthrough(0));
+  ASSERT(14, fallthrough(1));
+  ASSERT(8, fallthrough(3));
+  ASSERT(48, fallthrough(4));
+  ASSERT(32, fallthrough(5));
+
+  ASSERT(1, interpreter(1));
+  ASSERT(1, interpreter(1000));
+
+  printf("OK\n");
+  return 0;
+}
@@ -39,6 +39,25 @@ void fmt(char *buf, char *fmt, ...) {
   va_end(ap);
 }
 
+// The layout of a struct with a va_list member is computed at run time.
+struct VaMember {
+  char c;
+  va_list ap;
+  int a:3;
+  int b:30;
+  void *p;
+};
+
+int va_member(void) {
+  struct VaMember s;
+  s.c = 1;
+  s.a = 3;
+  s.b = -5;
+  s.p = &s;
+  return s.c == 1 && s.a == 3 && s.b == -5 && s.p == &s &&
+    (char *)&s.p - (char *)&s + sizeof(void *) <= sizeof(s);
+}
+
 int main() {
   ASSERT(6, sum1(1, 2, 3, 0));
   ASSERT(55, sum1(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0));
@@ -46,6 +65,8 @@ int main() {
   ASSERT(21, sum2(1, 2.0, 3, 4.0, 5, 6.0, 0));
   ASSERT(210, sum2(1, 2.0, 3, 4.0, 5, 6.0, 7, 8.0, 9, 10.0, 11, 12.0, 13, 14.0, 15, 16.0, 17, 18.0, 19, 20.0, 0));
 
+  ASSERT(1, va_member());
+
   printf("OK\n");
   return 0;
 }
@@ -471,13 +471,16 @@ static void convert_pp_number(Token *tok) {
   tok->ty = ty;
 }
 
+void convert_pp_token(Token *tok) {
+  if (is_keyword(tok))
+    tok->kind = TK_KEYWORD;
+  else if (tok->kind == TK_PP_NUM)
+    convert_pp_number(tok);
+}
+
 void convert_pp_tokens(Token *tok) {
-  for (Token *t = tok; t->kind != TK_EOF; t = t->next) {
-    if (is_keyword(t))
-      t->kind = TK_KEYWORD;
-    else if (t->kind == TK_PP_NUM)
-      convert_pp_number(t);
-  }
+  for (Token *t = tok; t->kind != TK_EOF; t = t->next)
+    convert_pp_token(t);
 }
 
 // Initialize line info for all tokens.
@@ -714,6 +717,20 @@ File *new_file(char *name, int file_no, char *contents) {
   return file;
 }
 
+// Registers a new input file. Input files are the files listed
+// in the assembler .file directives.
+File *add_input_file(char *path, char *contents) {
+  static int file_no;
+  File *file = new_file(path, file_no + 1, contents);
+
+  // Save the filename for assembler .file directive.
+  input_files = realloc(input_files, sizeof(char *) * (file_no + 2));
+  input_files[file_no] = file;
+  input_files[file_no + 1] = NULL;
+  file_no++;
+  return file;
+}
+
 // Replaces \r or \r\n with \n.
 static void canonicalize_newline(char *p) {
   int i = 0, j = 0;
@@ -818,15 +835,5 @@ Token *tokenize_file(char *path) {
   remove_backslash_newline(p);
   convert_universal_chars(p);
 
-  // Save the filename for assembler .file directive.
-  static int file_no;
-  File *file = new_file(path, file_no + 1, p);
-
-  // Save the filename for assembler .file directive.
-  input_files = realloc(input_files, sizeof(char *) * (file_no + 2));
-  input_files[file_no] = file;
-  input_files[file_no + 1] = NULL;
-  file_no++;
-
-  return tokenize(file);
+  return tokenize(add_input_file(path, p));
 }
@@ -0,0 +1,109 @@
+// This file implements -ftime-trace.
+//
+// Each span of work, such as parsing a function or preprocessing a
+// header, is recorded as a "complete" event of the Chrome trace event
+// format. The output can be loaded into chrome://tracing or Perfetto
+// to find the headers and functions that make a translation unit slow
+// to compile. Spans are nested per thread, so the preprocessor thread
+// of -fpipeline shows up as a separate track.
+
+#include "chibicc.h"
+
+typedef struct TraceEvent TraceEvent;
+struct TraceEvent {
+  TraceEvent *next;
+  TraceEvent *up;   // Enclosing span while the span is open
+  char *name;
+  char *detail;
+  int tid;
+  uint64_t start;
+  uint64_t end;
+};
+
+bool is_tracing;
+static uint64_t base_time;
+static int thread_count;
+
+// Finished events. Guarded by `lock`.
+static TraceEvent *events;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local TraceEvent *open_spans;
+static _Thread_local int thread_id;
+
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void enable_trace(void) {
+  is_tracing = true;
+  base_time = now();
+}
+
+// Opens a span. `detail` is shown as an argument of the event
+// and may be NULL.
+void trace_begin(char *name, char *detail) {
+  if (!is_tracing)
+    return;
+
+  if (!thread_id) {
+    pthread_mutex_lock(&lock);
+    thread_id = ++thread_count;
+    pthread_mutex_unlock(&lock);
+  }
+
+  TraceEvent *ev = calloc(1, sizeof(TraceEvent));
+  ev->name = name;
+  ev->detail = detail;
+  ev->tid = thread_id;
+  ev->up = open_spans;
+  open_spans = ev;
+  ev->start = now();
+}
+
+// Closes the innermost open span of the current thread. If `detail`
+// is not NULL, it replaces the one given to trace_begin().
+void trace_end(char *detail) {
+  if (!is_tracing)
+    return;
+
+  TraceEvent *ev = open_spans;
+  assert(ev);
+  ev->end = now();
+  if (detail)
+    ev->detail = detail;
+  open_spans = ev->up;
+
+  pthread_mutex_lock(&lock);
+  ev->next = events;
+  events = ev;
+  pthread_mutex_unlock(&lock);
+}
+
+void write_trace(char *path) {
+  FILE *out = fopen(path, "w");
+  if (!out)
+    error("cannot open output file: %s: %s", path, strerror(errno));
+
+  fprintf(out, "{\"traceEvents\":[");
+  for (TraceEvent *ev = events; ev; ev = ev->next) {
+    fprintf(out, "\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+            ev->tid, (ev->start - base_time) / 1000.0, (ev->end - ev->start) / 1000.0);
+    print_json_string(out, ev->name);
+    if (ev->detail) {
+      fprintf(out, ",\"args\":{\"detail\":");
+      print_json_string(out, ev->detail);
+      fprintf(out, "}");
+    }
+    fprintf(out, "},");
+  }
+
+  // Name the process so that the viewer does not show a bare pid.
+  fprintf(out, "\n{\"ph\":\"M\",\"pid\":1,\"tid\":1,\"name\":\"process_name\",");
+  fprintf(out, "\"args\":{\"name\":");
+  print_json_string(out, base_file);
+  fprintf(out, "}}],\n\"displayTimeUnit\":\"ms\"}\n");
+  fclose(out);
+}
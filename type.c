@@ -2,15 +2,15 @@
 
 MemoryModel mem_model;
 
-static Node *size0_node = &(Node){ND_NUM, 0};
-static Node *size1_node = &(Node){ND_NUM, 1};
-static Node *size2_node = &(Node){ND_NUM, 2};
-static Node *size4_node = &(Node){ND_NUM, 4};
-static Node *size8_node = &(Node){ND_NUM, 8};
-static Node *size16_node = &(Node){ND_NUM, 16};
-static Node *sizenint_node = &(Node){ND_SIZEOF, 0};
-static Node *sizenuint_node = &(Node){ND_SIZEOF, 0};
-static Node *sizevalist_node = &(Node){ND_SIZEOF, 0};
+static Node *size0_node = &(Node){ND_NUM, .val = 0};
+static Node *size1_node = &(Node){ND_NUM, .val = 1};
+static Node *size2_node = &(Node){ND_NUM, .val = 2};
+static Node *size4_node = &(Node){ND_NUM, .val = 4};
+static Node *size8_node = &(Node){ND_NUM, .val = 8};
+static Node *size16_node = &(Node){ND_NUM, .val = 16};
+static Node *sizenint_node = &(Node){ND_SIZEOF};
+static Node *sizenuint_node = &(Node){ND_SIZEOF};
+static Node *sizevalist_node = &(Node){ND_SIZEOF};
 
 Type *ty_void = &(Type){TY_VOID};
 Type *ty_bool = &(Type){TY_BOOL};
@@ -77,6 +77,7 @@ void init_type_system(MemoryModel mm) {
 
   sizevalist_node->kind = ND_SIZEOF;
   sizevalist_node->sizeof_ty = ty_va_list;
+  sizevalist_node->ty = ty_uintptr;   // size_t
 
   init_type(ty_void, size1_node, false, true);
   init_type(ty_bool, size1_node, true, true);
@@ -106,7 +107,35 @@ void init_type_system(MemoryModel mm) {
   ty_va_list->align = size8_node;
 }
 
+// The number of allocated types for -fmem-report. The preprocessor
+// thread of -fpipeline also makes types for string literals, so the
+// count is taken under a lock, and only if it is asked for.
+static long type_count;
+static pthread_mutex_t type_count_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void count_type(void) {
+  if (opt_fmem_report) {
+    pthread_mutex_lock(&type_count_lock);
+    type_count++;
+    pthread_mutex_unlock(&type_count_lock);
+  }
+}
+
+// Pointer and array types are hash-consed, so that structurally
+// identical ones share a Type object along with its size node and
+// CIL type name. A derived type is keyed by its base type object
+// and the array length.
+typedef struct {
+  Type *base;
+  int kind;
+  int array_len;
+} DerivedKey;
+
+static HashMap derived_types;
+static pthread_mutex_t derived_types_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static Type *new_type(TypeKind kind) {
+  count_type();
   Type *ty = calloc(1, sizeof(Type));
   ty->kind = kind;
   return ty;
@@ -180,35 +209,60 @@ bool is_compatible(Type *t1, Type *t2) {
 }
 
 Type *copy_type(Type *ty) {
+  count_type();
   Type *ret = calloc(1, sizeof(Type));
   *ret = *ty;
   ret->origin = ty;
   return ret;
 }
 
-Type *pointer_to(Type *base, Token *tok) {
+// Returns the canonical derived type for a given key, or calls `make`
+// to create it.
+static Type *derived_type(TypeKind kind, Type *base, int len, Token *tok,
+                          Type *(*make)(Type *, int, Token *)) {
+  DerivedKey key = {base, kind, len};
+
+  pthread_mutex_lock(&derived_types_lock);
+  Type *ty = hashmap_get2(&derived_types, (char *)&key, sizeof(key));
+  if (!ty) {
+    ty = make(base, len, tok);
+    DerivedKey *key2 = malloc(sizeof(key));
+    *key2 = key;
+    hashmap_put2(&derived_types, (char *)key2, sizeof(key), ty);
+  }
+  pthread_mutex_unlock(&derived_types_lock);
+  return ty;
+}
+
+// The size node of a shared pointer type has no token, since it
+// does not belong to any particular place in the source.
+static Type *new_pointer(Type *base, int len, Token *tok) {
   Type *ty = new_type(TY_PTR);
   ty->base = base;
   ty->is_unsigned = true;
   switch (mem_model) {
   case M32:
-    ty->size = new_typed_num(4, ty_intptr, tok);
+    ty->size = new_typed_num(4, ty_intptr, NULL);
     ty->align = ty->size;
     ty->is_fixed_size = true;
     break;
   case M64:
-    ty->size = new_typed_num(8, ty_intptr, tok);
+    ty->size = new_typed_num(8, ty_intptr, NULL);
     ty->align = ty->size;
     ty->is_fixed_size = true;
     break;
   default:
-    ty->size = new_sizeof(ty, tok);
+    ty->size = new_sizeof(ty, NULL);
     ty->align = ty->size;
     break;
   }
   return ty;
 }
 
+Type *pointer_to(Type *base, Token *tok) {
+  return derived_type(TY_PTR, base, 0, tok, new_pointer);
+}
+
 Type *func_type(Type *return_ty, Token *tok) {
   // The C spec disallows sizeof(<function type>), but
   // GCC allows that and the expression is evaluated to 1.
@@ -220,7 +274,7 @@ Type *func_type(Type *return_ty, Token *tok) {
   return ty;
 }
 
-Type *array_of(Type *base, int len, Token *tok) {
+static Type *new_array(Type *base, int len, Token *tok) {
   Type *ty = new_type(TY_ARRAY);
   ty->base = base;
   ty->array_len = len;
@@ -231,6 +285,15 @@ Type *array_of(Type *base, int len, Token *tok) {
   return ty;
 }
 
+Type *array_of(Type *base, int len, Token *tok) {
+  return derived_type(TY_ARRAY, base, len, tok, new_array);
+}
+
+void print_type_stats(FILE *out) {
+  fprintf(out, "Types: %ld types, %d distinct pointer and array types\n",
+          type_count, derived_types.used);
+}
+
 Type *enum_type(Token *tok) {
   Type *ty = new_type(TY_ENUM);
   ty->align = size4_node;
@@ -323,16 +386,29 @@ void add_type(Node *node) {
 
   add_type(node->lhs);
   add_type(node->rhs);
-  add_type(node->cond);
-  add_type(node->then);
-  add_type(node->els);
-  add_type(node->init);
-  add_type(node->inc);
 
-  for (Node *n = node->body; n; n = n->next)
-    add_type(n);
-  for (Node *n = node->args; n; n = n->next)
-    add_type(n);
+  switch (node->kind) {
+  case ND_IF:
+  case ND_FOR:
+  case ND_DO:
+  case ND_SWITCH:
+  case ND_COND:
+    add_type(node->cond);
+    add_type(node->then);
+    add_type(node->els);
+    add_type(node->init);
+    add_type(node->inc);
+    break;
+  case ND_BLOCK:
+  case ND_STMT_EXPR:
+    for (Node *n = node->body; n; n = n->next)
+      add_type(n);
+    break;
+  case ND_FUNCALL:
+    for (Node *n = node->args; n; n = n->next)
+      add_type(n);
+    break;
+  }
 
   switch (node->kind) {
   case ND_NUM:
@@ -372,6 +448,11 @@ void add_type(Node *node) {
       node->rhs = new_cast(node->rhs, node->lhs->ty);
     node->ty = node->lhs->ty;
     return;
+  case ND_COMPOUND_ASSIGN:
+  case ND_PREINC:
+  case ND_POSTINC:
+    node->ty = node->lhs->ty;
+    return;
   case ND_EQ:
   case ND_NE:
   case ND_LT:
@@ -438,7 +519,12 @@ void add_type(Node *node) {
     error_tok(node->tok, "statement expression returning void is not supported");
     return;
   case ND_NULL_EXPR:
+  case ND_MEMCPY:
     node->ty = ty_void;
     return;
+  case ND_MEMZERO:
+    if (!node->var)
+      node->ty = ty_void;
+    return;
   }
 }
@@ -21,6 +21,86 @@ int calculate_size(Type *ty) {
   return -1;
 }
 
+// Evaluates a size or alignment expression for a given pointer size.
+bool eval_for_ptr_size(Node *node, int ptr_size, int64_t *val) {
+  int64_t lhs, rhs;
+
+  switch (node->kind) {
+  case ND_NUM:
+    *val = node->val;
+    return true;
+  case ND_SIZEOF: {
+    Type *ty = node->sizeof_ty;
+    int sz = calculate_size(ty);
+    if (sz >= 0) {
+      *val = sz;
+      return true;
+    }
+    switch (ty->kind) {
+    case TY_PTR:
+    case TY_INTPTR:
+      *val = ptr_size;
+      return true;
+    case TY_ARRAY:
+      if (!eval_for_ptr_size(ty->base->size, ptr_size, val))
+        return false;
+      *val *= ty->array_len;
+      return true;
+    case TY_STRUCT:
+    case TY_UNION:
+      return ty->size != node && eval_for_ptr_size(ty->size, ptr_size, val);
+    }
+    return false;
+  }
+  case ND_VAR: {
+    // Cached displacement
+    Node *init_expr = node->var->init_expr;
+    return init_expr && init_expr->kind == ND_ASSIGN && init_expr->lhs->var == node->var &&
+      eval_for_ptr_size(init_expr->rhs, ptr_size, val);
+  }
+  case ND_CAST:
+    return eval_for_ptr_size(node->lhs, ptr_size, val);
+  case ND_COND:
+    if (!eval_for_ptr_size(node->cond, ptr_size, &lhs))
+      return false;
+    return eval_for_ptr_size(lhs ? node->then : node->els, ptr_size, val);
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SHL:
+  case ND_SHR:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+    if (!eval_for_ptr_size(node->lhs, ptr_size, &lhs) ||
+        !eval_for_ptr_size(node->rhs, ptr_size, &rhs))
+      return false;
+    switch (node->kind) {
+    case ND_ADD: *val = lhs + rhs; return true;
+    case ND_SUB: *val = lhs - rhs; return true;
+    case ND_MUL: *val = lhs * rhs; return true;
+    case ND_DIV: *val = rhs ? lhs / rhs : 0; return rhs != 0;
+    case ND_MOD: *val = rhs ? lhs % rhs : 0; return rhs != 0;
+    case ND_BITAND: *val = lhs & rhs; return true;
+    case ND_BITOR: *val = lhs | rhs; return true;
+    case ND_BITXOR: *val = lhs ^ rhs; return true;
+    case ND_SHL: *val = lhs << rhs; return true;
+    case ND_SHR: *val = lhs >> rhs; return true;
+    case ND_EQ: *val = lhs == rhs; return true;
+    case ND_NE: *val = lhs != rhs; return true;
+    case ND_LT: *val = lhs < rhs; return true;
+    case ND_LE: *val = lhs <= rhs; return true;
+    }
+  }
+  return false;
+}
+
 Node *align_to_node(Node *n, Node *align) {
   // (n + align - 1) / align * align;
   Node *next = new_binary(
@@ -31,7 +111,11 @@ Node *align_to_node(Node *n, Node *align) {
     ND_MUL, based, align, NULL);
 }
 
-char *to_cil_typename(Type *ty) {
+// CIL type names are made on first use, and the code generator
+// threads ask for them concurrently.
+static pthread_mutex_t cil_name_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *to_cil_typename2(Type *ty) {
   static int count = 0;
 
   switch (ty->kind) {
@@ -67,14 +151,14 @@ char *to_cil_typename(Type *ty) {
   switch (ty->kind) {
     case TY_ARRAY: {
       if (ty->array_len >= 1)
-        ty->cil_name = format("%s[%d]", to_cil_typename(ty->base), ty->array_len);
+        ty->cil_name = format("%s[%d]", to_cil_typename2(ty->base), ty->array_len);
       else
         // Flexible array (0) / Unapplied size array (-1)
-        ty->cil_name = format("%s[*]", to_cil_typename(ty->base));
+        ty->cil_name = format("%s[*]", to_cil_typename2(ty->base));
       return ty->cil_name;
     }
     case TY_PTR: {
-      ty->cil_name = format("%s*", to_cil_typename(ty->base));
+      ty->cil_name = format("%s*", to_cil_typename2(ty->base));
       return ty->cil_name;
     }
     case TY_ENUM:
@@ -97,19 +181,26 @@ char *to_cil_typename(Type *ty) {
       char *c = "";
       Type *pty = ty->params;
       while (pty) {
-        c = *c == '\0' ? to_cil_typename(pty) : format("%s,%s", c, to_cil_typename(pty));
+        c = *c == '\0' ? to_cil_typename2(pty) : format("%s,%s", c, to_cil_typename2(pty));
         pty = pty->next;
       }
       // .NET: See **VARARG**
       ty->cil_name = ty->is_variadic ?
-        format("%s(%s,C.type.__va_arglist)", to_cil_typename(ty->return_ty), c) :
-        format("%s(%s)", to_cil_typename(ty->return_ty), c);
+        format("%s(%s,C.type.__va_arglist)", to_cil_typename2(ty->return_ty), c) :
+        format("%s(%s)", to_cil_typename2(ty->return_ty), c);
       return ty->cil_name;
     }
   }
   unreachable();
 }
 
+char *to_cil_typename(Type *ty) {
+  pthread_mutex_lock(&cil_name_lock);
+  char *name = to_cil_typename2(ty);
+  pthread_mutex_unlock(&cil_name_lock);
+  return name;
+}
+
 bool equals_type(Type *lhs, Type *rhs) {
   if (lhs == NULL || rhs == NULL)
     // Be not added types on add_type().
@@ -166,6 +257,10 @@ bool equals_node(Node *lhs, Node *rhs) {
   if (lhs == NULL || rhs == NULL)
     return false;
 
+  // Structurally identical canonical nodes are the same object.
+  if (lhs->is_canonical && rhs->is_canonical)
+    return false;
+
   if (lhs->kind != rhs->kind) {
     // For displacement caching (2)
     if (lhs->kind == ND_VAR &&
@@ -200,6 +295,9 @@ bool equals_node(Node *lhs, Node *rhs) {
     case ND_LOGOR:
     case ND_COMMA:
     case ND_ASSIGN:
+    case ND_COMPOUND_ASSIGN:
+    case ND_PREINC:
+    case ND_POSTINC:
     case ND_COMPLEX:
       return
         equals_node(lhs->lhs, rhs->lhs) &&
@@ -233,8 +331,16 @@ bool equals_node(Node *lhs, Node *rhs) {
     case ND_NUM:
       return lhs->val == rhs->val;
     case ND_VAR:
-    case ND_MEMZERO:
       return lhs->var == rhs->var;
+    case ND_MEMZERO:
+      if (lhs->var || rhs->var)
+        return lhs->var == rhs->var;
+      return equals_node(lhs->lhs, rhs->lhs) && lhs->val == rhs->val;
+    case ND_MEMCPY:
+      return
+        equals_node(lhs->lhs, rhs->lhs) &&
+        equals_node(lhs->rhs, rhs->rhs) &&
+        lhs->val == rhs->val;
     case ND_SIZEOF:
       return equals_type(lhs->sizeof_ty, rhs->sizeof_ty);
     case ND_NULL_EXPR:
@@ -244,7 +350,48 @@ bool equals_node(Node *lhs, Node *rhs) {
   }
 }
 
+// Calls `visit` for each node of the tree in preorder.
+void walk_node(Node *node, void (*visit)(Node *node)) {
+  if (!node)
+    return;
+
+  visit(node);
+  walk_node(node->lhs, visit);
+  walk_node(node->rhs, visit);
+
+  switch (node->kind) {
+    case ND_IF:
+    case ND_FOR:
+    case ND_DO:
+    case ND_SWITCH:
+    case ND_COND:
+      walk_node(node->cond, visit);
+      walk_node(node->then, visit);
+      walk_node(node->els, visit);
+      walk_node(node->init, visit);
+      walk_node(node->inc, visit);
+      return;
+    case ND_BLOCK:
+    case ND_STMT_EXPR:
+      for (Node *n = node->body; n; n = n->next)
+        walk_node(n, visit);
+      return;
+    case ND_FUNCALL:
+      for (Node *arg = node->args; arg; arg = arg->next)
+        walk_node(arg, visit);
+      return;
+    case ND_ADD_OVF:
+    case ND_SUB_OVF:
+    case ND_MUL_OVF:
+      walk_node(node->res, visit);
+      return;
+  }
+}
+
 static bool is_immutable(Node *node) {
+  if (node->is_interned)
+    return node->is_immutable_expr;
+
   switch (node->kind) {
     case ND_ADD:
     case ND_SUB:
@@ -281,7 +428,13 @@ static bool is_immutable(Node *node) {
       return is_immutable(node->cond) && is_immutable(node->then) && is_immutable(node->els);
     case ND_MEMBER:
     case ND_VAR:
+    case ND_COMPOUND_ASSIGN:
+    case ND_PREINC:
+    case ND_POSTINC:
     case ND_MEMZERO:
+    case ND_MEMCPY:
+    case ND_FUNCALL:
+    case ND_STMT_EXPR:
       return false;
     case ND_NUM:
     case ND_SIZEOF:
@@ -301,7 +454,9 @@ int64_t get_by_integer(Node *node) {
   case TY_SHORT:
     return node->ty->is_unsigned ? (uint16_t)node->val : (int16_t)node->val;
   case TY_INT:
-    return node->ty->is_unsigned ? (uint32_t)node->val : (int32_t)node->val;
+    // Without the casts to int64_t, a negative int would be converted
+    // to uint32_t.
+    return node->ty->is_unsigned ? (int64_t)(uint32_t)node->val : (int64_t)(int32_t)node->val;
   case TY_ENUM:
     return (int32_t)node->val;
   case TY_LONG:
@@ -326,14 +481,14 @@ static double get_by_flonum(Node *node) {
   case TY_SHORT:
     return node->ty->is_unsigned ? (uint16_t)node->val : (int16_t)node->val;
   case TY_INT:
-    return node->ty->is_unsigned ? (uint32_t)node->val : (int32_t)node->val;
+    return node->ty->is_unsigned ? (double)(uint32_t)node->val : (double)(int32_t)node->val;
   case TY_ENUM:
     return (int32_t)node->val;
   case TY_LONG:
-    return node->ty->is_unsigned ? (uint64_t)node->val : node->val;
+    return node->ty->is_unsigned ? (double)(uint64_t)node->val : (double)node->val;
   case TY_INTPTR:
   case TY_PTR:
-    return node->ty->is_unsigned ? (uint64_t)(void *)node->val : (int64_t)(void *)node->val;
+    return node->ty->is_unsigned ? (double)(uint64_t)(void *)node->val : (double)(int64_t)(void *)node->val;
   case TY_FLOAT:
     return (float)node->fval;
   case TY_DOUBLE:
@@ -382,6 +537,201 @@ static bool is_flonum_equals(Node *node, double fval) {
   return node->kind == ND_NUM && is_flonum(node->ty) && node->fval == fval;
 }
 
+// Reducing a node whose operands did not change gives the node
+// itself, so that an already reduced tree is not copied again.
+static Node *reuse_binary(Node *node, Node *lhs, Node *rhs) {
+  if (lhs == node->lhs && rhs == node->rhs)
+    return node;
+  Node *nnode = new_binary(node->kind, lhs, rhs, node->tok);
+  nnode->ty = node->ty;
+  return nnode;
+}
+
+static Node *reuse_unary(Node *node, Node *lhs) {
+  if (lhs == node->lhs)
+    return node;
+  Node *nnode = new_unary(node->kind, lhs, node->tok);
+  nnode->ty = node->ty;
+  return nnode;
+}
+
+// Algebraic simplification
+//
+// An integer expression is kept in a canonical form where the constant
+// operand of a commutative operator is on the right, so that chains such
+// as `(x + 4) + 8` or `(x * 4) * 2` merge their constants. Multiplications
+// and unsigned divisions by a power of two become shifts, and `x * 8 / 8`
+// cancels out when it can not wrap around.
+
+static bool is_simplifiable(Type *ty) {
+  return (is_integer(ty) && ty->kind != TY_BOOL) || ty->kind == TY_PTR;
+}
+
+static bool is_integer_num(Node *node) {
+  return node->kind == ND_NUM && is_simplifiable(node->ty);
+}
+
+static bool is_commutative(NodeKind kind) {
+  return kind == ND_ADD || kind == ND_MUL ||
+    kind == ND_BITAND || kind == ND_BITOR || kind == ND_BITXOR;
+}
+
+// Returns k if val is 2^k, or -1.
+static int log2_of(int64_t val) {
+  if (val <= 0 || (val & (val - 1)))
+    return -1;
+  int k = 0;
+  while (val > 1) {
+    val >>= 1;
+    k++;
+  }
+  return k;
+}
+
+static Node *new_simplified(NodeKind kind, Node *lhs, Node *rhs, Node *orig) {
+  Node *node = new_binary(kind, lhs, rhs, orig->tok);
+  node->ty = orig->ty;
+  return reduce(node);
+}
+
+// x + off, or x - (-off)
+static Node *new_offset(Node *lhs, int64_t off, Type *off_ty, Node *orig) {
+  if (off == 0)
+    return cast_type(lhs, orig->ty);
+  if (off > 0)
+    return new_simplified(ND_ADD, lhs, new_typed_num(off, off_ty, orig->tok), orig);
+  return new_simplified(ND_SUB, lhs, new_typed_num(-off, off_ty, orig->tok), orig);
+}
+
+// Splits `x * c` or `x << k` into x and its constant factor.
+static bool split_scale(Node *node, Type *ty, Node **base, int64_t *scale) {
+  if ((node->kind != ND_MUL && node->kind != ND_SHL) ||
+      !equals_type(node->ty, ty) || !is_integer_num(node->rhs))
+    return false;
+  int64_t val = get_by_integer(node->rhs);
+  if (node->kind == ND_MUL)
+    *scale = val;
+  else if (val >= 0 && val < 62)
+    *scale = (int64_t)1 << val;
+  else
+    return false;
+  *base = node->lhs;
+  return true;
+}
+
+static Node *simplify(Node *node, Node *lhs, Node *rhs) {
+  Type *ty = node->ty;
+  if (!ty || !is_simplifiable(ty) || (lhs->kind == ND_NUM && rhs->kind == ND_NUM))
+    return NULL;
+
+  // c op x => x op c
+  if (is_commutative(node->kind) && is_integer_num(lhs))
+    return new_simplified(node->kind, rhs, lhs, node);
+
+  if (!is_integer_num(rhs) || !lhs->ty)
+    return NULL;
+  int64_t val = get_by_integer(rhs);
+  bool is_same_ty = equals_type(lhs->ty, ty);
+
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB: {
+    // (x ± c1) ± c2 => x ± c
+    int64_t off = node->kind == ND_ADD ? val : -val;
+    if ((lhs->kind == ND_ADD || lhs->kind == ND_SUB) && is_same_ty && is_integer_num(lhs->rhs)) {
+      int64_t inner = get_by_integer(lhs->rhs);
+      return new_offset(lhs->lhs, off + (lhs->kind == ND_ADD ? inner : -inner), rhs->ty, node);
+    }
+    return NULL;
+  }
+  case ND_MUL: {
+    // (x * c1) * c2 => x * (c1 * c2)
+    Node *base;
+    int64_t scale;
+    if (split_scale(lhs, ty, &base, &scale))
+      return new_simplified(ND_MUL, base, new_typed_num((uint64_t)scale * val, rhs->ty, rhs->tok), node);
+
+    // x * 2^k => x << k
+    int k = log2_of(val);
+    if (k > 0 && is_same_ty && ty->kind != TY_PTR)
+      return new_simplified(ND_SHL, lhs, new_typed_num(k, ty_int, rhs->tok), node);
+    return NULL;
+  }
+  case ND_DIV: {
+    if (val <= 0)
+      return NULL;
+
+    // (x * c1) / c2 => x * (c1 / c2) or x / (c2 / c1), unless x * c1
+    // may wrap around. The sizes of types do not.
+    Node *base;
+    int64_t scale;
+    if (split_scale(lhs, ty, &base, &scale) && scale > 0 &&
+        (!ty->is_unsigned || is_immutable(base))) {
+      if (scale % val == 0)
+        return new_simplified(ND_MUL, base, new_typed_num(scale / val, rhs->ty, rhs->tok), node);
+      if (val % scale == 0)
+        return new_simplified(ND_DIV, base, new_typed_num(val / scale, rhs->ty, rhs->tok), node);
+    }
+
+    // (x / c1) / c2 => x / (c1 * c2), unless c1 * c2 overflows the type
+    if (lhs->kind == ND_DIV && is_same_ty && is_integer_num(lhs->rhs)) {
+      int64_t inner = get_by_integer(lhs->rhs);
+      int sz = calculate_size(ty);
+      int bits = sz * 8 - !ty->is_unsigned;
+      if (inner > 0 && inner <= INT32_MAX && val <= INT32_MAX && sz > 0 &&
+          (bits >= 62 || inner * val < ((int64_t)1 << bits)))
+        return new_simplified(ND_DIV, lhs->lhs, new_typed_num(inner * val, rhs->ty, rhs->tok), node);
+    }
+
+    // x / 2^k => x >> k for unsigned x
+    int k = log2_of(val);
+    if (k > 0 && is_same_ty && ty->is_unsigned && ty->kind != TY_PTR)
+      return new_simplified(ND_SHR, lhs, new_typed_num(k, ty_int, rhs->tok), node);
+    return NULL;
+  }
+  case ND_MOD: {
+    // x % 2^k => x & (2^k - 1) for unsigned x
+    if (log2_of(val) > 0 && is_same_ty && ty->is_unsigned && ty->kind != TY_PTR)
+      return new_simplified(ND_BITAND, lhs, new_typed_num(val - 1, rhs->ty, rhs->tok), node);
+    return NULL;
+  }
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR: {
+    // (x op c1) op c2 => x op (c1 op c2)
+    if (lhs->kind != node->kind || !is_same_ty || !is_integer_num(lhs->rhs))
+      return NULL;
+    int64_t inner = get_by_integer(lhs->rhs);
+    int64_t merged = node->kind == ND_BITAND ? inner & val :
+      node->kind == ND_BITOR ? inner | val : inner ^ val;
+    return new_simplified(node->kind, lhs->lhs, new_typed_num(merged, rhs->ty, rhs->tok), node);
+  }
+  case ND_SHL:
+  case ND_SHR: {
+    if ((lhs->kind != ND_SHL && lhs->kind != ND_SHR) || !is_same_ty || !is_integer_num(lhs->rhs))
+      return NULL;
+    int64_t inner = get_by_integer(lhs->rhs);
+
+    // (x >> k) << k => x & ~(2^k - 1) for unsigned x
+    if (node->kind == ND_SHL && lhs->kind == ND_SHR && inner == val &&
+        ty->is_unsigned && val > 0 && val < 62)
+      return new_simplified(ND_BITAND, lhs->lhs, new_typed_num(~(((int64_t)1 << val) - 1), ty, rhs->tok), node);
+
+    // (x << c1) << c2 => x << (c1 + c2)
+    int sz = calculate_size(ty);
+    if (lhs->kind != node->kind || inner < 0 || val < 0 || sz < 0 || inner + val >= sz * 8)
+      return NULL;
+    return new_simplified(node->kind, lhs->lhs, new_typed_num(inner + val, rhs->ty, rhs->tok), node);
+  }
+  }
+  return NULL;
+}
+
+static Node *reduce_binary(Node *node, Node *lhs, Node *rhs) {
+  Node *nnode = simplify(node, lhs, rhs);
+  return nnode ? nnode : reuse_binary(node, lhs, rhs);
+}
+
 static Node *reduce_(Node *node) {
   Node *lhs;
   Node *rhs;
@@ -395,7 +745,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_equals(rhs, 0) || is_flonum_equals(rhs, 0.0))
       return cast_type(lhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_ADD, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_SUB:
     lhs = reduce(node->lhs);
@@ -403,7 +753,7 @@ static Node *reduce_(Node *node) {
     if (is_integer_equals(rhs, 0) || is_flonum_equals(rhs, 0.0))
       return cast_type(lhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_SUB, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_MUL:
     lhs = reduce(node->lhs);
@@ -417,7 +767,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_equals(rhs, 1) || is_flonum_equals(rhs, 1.0))
       return cast_type(lhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_MUL, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_DIV:
     lhs = reduce(node->lhs);
@@ -427,7 +777,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_equals(rhs, 1) || is_flonum_equals(rhs, 1.0))
       return cast_type(lhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_DIV, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_MOD:
     lhs = reduce(node->lhs);
@@ -439,7 +789,7 @@ static Node *reduce_(Node *node) {
     else if (is_flonum_equals(rhs, 1.0))
       return new_flonum(0.0, node->ty, node->tok);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_MOD, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_ADD_OVF:
   case ND_SUB_OVF:
@@ -447,6 +797,8 @@ static Node *reduce_(Node *node) {
     lhs = reduce(node->lhs);
     rhs = reduce(node->rhs);
     Node *res = reduce(node->res);
+    if (lhs == node->lhs && rhs == node->rhs && res == node->res)
+      return node;
     Node *n = new_binary(node->kind, lhs, rhs, node->tok);
     n->res = res;
     return n;
@@ -459,7 +811,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_equals(rhs, 0))
       return new_typed_num(0, node->ty, node->tok);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_BITAND, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_BITOR:
     lhs = reduce(node->lhs);
@@ -469,7 +821,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_equals(rhs, 0))
       return cast_type(lhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_BITOR, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_BITXOR:
     lhs = reduce(node->lhs);
@@ -479,7 +831,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_equals(rhs, 0))
       return cast_type(lhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_BITXOR, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_SHL:
   case ND_SHR:
@@ -490,7 +842,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_equals(rhs, 0))
       return cast_type(lhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(node->kind, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_LOGAND:
     lhs = reduce(node->lhs);
@@ -504,7 +856,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_not_equals(rhs, 0))
       return cast_type(lhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_LOGAND, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_LOGOR:
     lhs = reduce(node->lhs);
@@ -518,7 +870,7 @@ static Node *reduce_(Node *node) {
     else if (is_integer_not_equals(rhs, 0))
       return cast_type(rhs, node->ty);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_LOGOR, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_EQ:
     lhs = reduce(node->lhs);
@@ -535,12 +887,12 @@ static Node *reduce_(Node *node) {
       return new_typed_num((lv == rv) ? 1 : 0, node->ty, node->tok);
     }
     else
-      return new_binary(ND_EQ, lhs, rhs, node->tok);
+      return reuse_binary(node, lhs, rhs);
     break;
   case ND_NE:
     lhs = reduce(node->lhs);
     rhs = reduce(node->rhs);
-    if (!equals_node(lhs, rhs) && is_immutable(lhs))
+    if (equals_node(lhs, rhs) && is_immutable(lhs))
       return new_typed_num(0, node->ty, node->tok);
     else if (lhs->kind == ND_NUM && rhs->kind == ND_NUM) {
       bool li = is_integer(lhs->ty);
@@ -552,7 +904,7 @@ static Node *reduce_(Node *node) {
       return new_typed_num((lv != rv) ? 1 : 0, node->ty, node->tok);
     }
     else
-      return new_binary(ND_NE, lhs, rhs, node->tok);
+      return reuse_binary(node, lhs, rhs);
     break;
   case ND_LE:
     lhs = reduce(node->lhs);
@@ -560,7 +912,7 @@ static Node *reduce_(Node *node) {
     if (equals_node(lhs, rhs) && is_immutable(lhs))
       return new_typed_num(1, node->ty, node->tok);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_LE, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_LT:
     lhs = reduce(node->lhs);
@@ -568,28 +920,33 @@ static Node *reduce_(Node *node) {
     if (equals_node(lhs, rhs) && is_immutable(lhs))
       return new_typed_num(0, node->ty, node->tok);
     else if (lhs->kind != ND_NUM || rhs->kind != ND_NUM)
-      return new_binary(ND_LT, lhs, rhs, node->tok);
+      return reduce_binary(node, lhs, rhs);
     break;
   case ND_COMMA:
     lhs = reduce(node->lhs);
     rhs = reduce(node->rhs);
     if (lhs->kind == ND_NULL_EXPR)
       return cast_type(rhs, node->ty);
-    return new_binary(ND_COMMA, lhs, rhs, node->tok);
+    return reuse_binary(node, lhs, rhs);
   case ND_NEG:
   case ND_NOT:
   case ND_BITNOT:
     lhs = reduce(node->lhs);
     if (lhs->kind != ND_NUM)
-      return new_unary(node->kind, lhs, node->tok);
+      return reuse_unary(node, lhs);
     break;
   case ND_COND: {
     Node *cond = reduce(node->cond);
     if (cond->kind != ND_NUM) {
+      Node *then = reduce(node->then);
+      Node *els = reduce(node->els);
+      if (cond == node->cond && then == node->then && els == node->els)
+        return node;
       Node *nnode = new_node(ND_COND, node->tok);
       nnode->cond = cond;
-      nnode->then = reduce(node->then);
-      nnode->els = reduce(node->els);
+      nnode->then = then;
+      nnode->els = els;
+      nnode->ty = node->ty;
       return nnode;
     } else if (is_integer(cond->ty))
       return cond->val ? reduce(node->then) : reduce(node->els);
@@ -603,19 +960,33 @@ static Node *reduce_(Node *node) {
   case ND_ASSIGN:
     lhs = reduce(node->lhs);
     rhs = reduce(node->rhs);
-    return new_binary(ND_ASSIGN, lhs, rhs, node->tok);
+    return reuse_binary(node, lhs, rhs);
+  case ND_COMPOUND_ASSIGN:
+  case ND_PREINC:
+  case ND_POSTINC:
+    // The operation itself is kept, because codegen applies it
+    // to the loaded value of the lhs. Only its operand is reduced.
+    lhs = reduce(node->lhs);
+    rhs = reduce(node->rhs->rhs);
+    return reuse_binary(node, lhs, reuse_binary(node->rhs, node->rhs->lhs, rhs));
   case ND_ADDR:
   case ND_DEREF: {
     lhs = reduce(node->lhs);
+    if (lhs == node->lhs)
+      return node;
     Node *nnode = new_node(node->kind, node->tok);
     nnode->lhs = lhs;
+    nnode->ty = node->ty;
     return nnode;
   }
   case ND_MEMBER: {
     lhs = reduce(node->lhs);
+    if (lhs == node->lhs)
+      return node;
     Node *nnode = new_node(ND_MEMBER, node->tok);
     nnode->lhs = lhs;
     nnode->member = node->member;
+    nnode->ty = node->ty;
     return nnode;
   }
   case ND_SIZEOF: {
@@ -631,14 +1002,37 @@ static Node *reduce_(Node *node) {
       node->var->init_expr = reduce(node->var->init_expr);
     return node;
   }
+  case ND_MEMZERO: {
+    if (node->var)
+      return node;
+    lhs = reduce(node->lhs);
+    if (lhs == node->lhs)
+      return node;
+    Node *nnode = new_unary(ND_MEMZERO, lhs, node->tok);
+    nnode->val = node->val;
+    return nnode;
+  }
+  case ND_MEMCPY: {
+    lhs = reduce(node->lhs);
+    rhs = reduce(node->rhs);
+    if (lhs == node->lhs && rhs == node->rhs)
+      return node;
+    Node *nnode = new_binary(ND_MEMCPY, lhs, rhs, node->tok);
+    nnode->val = node->val;
+    return nnode;
+  }
   case ND_NUM:
-  case ND_MEMZERO:
   case ND_NULL_EXPR:
     return node;
+  case ND_FUNCALL:
+  case ND_STMT_EXPR:
+    // Calls and statement expressions are never constant. They reach
+    // here from initializer elements that are tested for constness.
+    return node;
   case ND_COMPLEX:
     lhs = reduce(node->lhs);
     rhs = reduce(node->rhs);
-    return new_binary(ND_COMPLEX, lhs, rhs, node->tok);
+    return reuse_binary(node, lhs, rhs);
   default:
     unreachable();
   }
@@ -730,6 +1124,210 @@ static Node *reduce_(Node *node) {
   unreachable();
 }
 
+// Hash-consing
+//
+// Reduced expressions are interned, keyed by their kind, type, value
+// and the identities of their already interned operands. Identical
+// subexpressions such as aligned offsets are shared, and two canonical
+// nodes, whose whole subtrees are interned, are structurally equal
+// only if they are the same object.
+//
+// The token is a part of the key, so that the locations of source
+// expressions are kept. Only the expressions made by the compiler
+// itself, such as struct layouts, have no token and are canonical.
+//
+// Struct layouts intern tens of thousands of nodes, so the nodes are
+// kept in an open-addressing table of their own, hashed by words
+// rather than through the byte-wise HashMap.
+typedef struct {
+  NodeKind kind;
+  Type *ty;
+  Token *tok;
+  void *operands[3];
+  int64_t val;
+  double fval;
+} NodeKey;
+
+typedef struct {
+  uint64_t hash;
+  Node *node;
+} InternEntry;
+
+static InternEntry *interned_nodes;
+static int intern_capacity;
+static int intern_used;
+static long intern_hits;
+
+static bool is_internable(Node *node) {
+  if (!node->ty || node->next)
+    return false;
+
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SHL:
+  case ND_SHR:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+  case ND_LOGAND:
+  case ND_LOGOR:
+  case ND_NEG:
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_ADDR:
+  case ND_DEREF:
+  case ND_CAST:
+  case ND_MEMBER:
+  case ND_COND:
+  case ND_NUM:
+  case ND_VAR:
+  case ND_SIZEOF:
+    return true;
+  }
+  return false;
+}
+
+static bool is_canonical(Node *node) {
+  return !node || node->is_canonical;
+}
+
+static NodeKey node_key(Node *node) {
+  NodeKey key = {node->kind, node->ty, node->tok};
+  switch (node->kind) {
+  case ND_COND:
+    key.operands[0] = node->cond;
+    key.operands[1] = node->then;
+    key.operands[2] = node->els;
+    break;
+  case ND_MEMBER:
+    key.operands[0] = node->lhs;
+    key.operands[1] = node->member;
+    break;
+  case ND_VAR:
+    key.operands[0] = node->var;
+    break;
+  case ND_SIZEOF:
+    key.operands[0] = node->sizeof_ty;
+    break;
+  case ND_NUM:
+    key.val = node->val;
+    key.fval = node->fval;
+    break;
+  default:
+    key.operands[0] = node->lhs;
+    key.operands[1] = node->rhs;
+  }
+  return key;
+}
+
+static bool equals_key(NodeKey *a, NodeKey *b) {
+  return a->kind == b->kind && a->ty == b->ty && a->tok == b->tok &&
+         a->operands[0] == b->operands[0] &&
+         a->operands[1] == b->operands[1] &&
+         a->operands[2] == b->operands[2] &&
+         a->val == b->val && !memcmp(&a->fval, &b->fval, sizeof(double));
+}
+
+static uint64_t mix_hash(uint64_t hash, uint64_t word) {
+  hash ^= word;
+  hash *= 0x9e3779b97f4a7c15;
+  return hash ^ (hash >> 29);
+}
+
+static uint64_t hash_key(NodeKey *key) {
+  uint64_t fbits;
+  memcpy(&fbits, &key->fval, sizeof(fbits));
+
+  uint64_t hash = key->kind;
+  hash = mix_hash(hash, (uintptr_t)key->ty);
+  hash = mix_hash(hash, (uintptr_t)key->tok);
+  hash = mix_hash(hash, (uintptr_t)key->operands[0]);
+  hash = mix_hash(hash, (uintptr_t)key->operands[1]);
+  hash = mix_hash(hash, (uintptr_t)key->operands[2]);
+  hash = mix_hash(hash, key->val);
+  return mix_hash(hash, fbits);
+}
+
+// Returns the slot of an equal node, or the empty slot to put it in.
+static InternEntry *find_interned(NodeKey *key, uint64_t hash) {
+  int mask = intern_capacity - 1;
+  for (int i = hash & mask;; i = (i + 1) & mask) {
+    InternEntry *ent = &interned_nodes[i];
+    if (!ent->node)
+      return ent;
+    if (ent->hash == hash) {
+      NodeKey key2 = node_key(ent->node);
+      if (equals_key(key, &key2))
+        return ent;
+    }
+  }
+}
+
+static void grow_interned(void) {
+  InternEntry *old = interned_nodes;
+  int old_capacity = intern_capacity;
+
+  intern_capacity = old_capacity ? old_capacity * 2 : 1024;
+  interned_nodes = calloc(intern_capacity, sizeof(InternEntry));
+
+  int mask = intern_capacity - 1;
+  for (int i = 0; i < old_capacity; i++) {
+    if (!old[i].node)
+      continue;
+    int j = old[i].hash & mask;
+    while (interned_nodes[j].node)
+      j = (j + 1) & mask;
+    interned_nodes[j] = old[i];
+  }
+  free(old);
+}
+
+static Node *intern_node(Node *node) {
+  if (node->is_interned || !is_internable(node))
+    return node;
+
+  // Keep the load factor below 50%.
+  if (intern_used * 2 >= intern_capacity)
+    grow_interned();
+
+  NodeKey key = node_key(node);
+  uint64_t hash = hash_key(&key);
+  InternEntry *ent = find_interned(&key, hash);
+  if (ent->node) {
+    intern_hits++;
+    return ent->node;
+  }
+
+  node->is_immutable_expr = is_immutable(node);
+  node->is_interned = true;
+
+  // A cached displacement is compared with its expression by
+  // equals_node(), so it is not canonical.
+  bool is_disp = node->kind == ND_VAR && node->var->init_expr;
+  node->is_canonical = !is_disp && !node->tok &&
+    is_canonical(node->lhs) && is_canonical(node->rhs) &&
+    (node->kind != ND_COND ||
+     (is_canonical(node->cond) && is_canonical(node->then) && is_canonical(node->els)));
+
+  ent->hash = hash;
+  ent->node = node;
+  intern_used++;
+  return node;
+}
+
+void print_reduce_stats(FILE *out) {
+  fprintf(out, "Reduced expressions: %d interned, %ld shared\n",
+          intern_used, intern_hits);
+}
+
 static Node *reduce(Node *node) {
   if (!node)
     return node;
@@ -737,7 +1335,7 @@ static Node *reduce(Node *node) {
     node = reduce_(node);
     node->is_reduced = true;
   }
-  return node;
+  return intern_node(node);
 }
 
 Node *reduce_node(Node *node) {